@@ -0,0 +1,734 @@
+/*
+  Action Timeline
+  Copyright 2020 Karl Robillard
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <QFile>
+#include <QMimeData>
+#include <QtEndian>
+#include "ActionList.h"
+
+#define DUR_MIN     1
+#define DUR_MAX     10
+
+
+static inline char _lower( char c )
+{
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+
+static inline uint32_t _trigram( const char* cp )
+{
+    return (uint32_t(uint8_t(_lower(cp[0]))) << 16) |
+           (uint32_t(uint8_t(_lower(cp[1]))) << 8) |
+            uint32_t(uint8_t(_lower(cp[2])));
+}
+
+
+/*
+  Compare the lowercase forms of at most n characters of a & b.
+*/
+static int _compareNoCase( const char* a, const char* b, size_t n )
+{
+    for( ; n; --n, ++a, ++b )
+    {
+        int d = uint8_t(_lower(*a)) - uint8_t(_lower(*b));
+        if( d || ! *a )
+            return d;
+    }
+    return 0;
+}
+
+
+struct NameLess
+{
+    const ActionTable* at;
+    bool operator()( int a, int b ) const
+    {
+        return _compareNoCase( at->name(a), at->name(b), size_t(-1) ) < 0;
+    }
+};
+
+
+struct PrefixLess
+{
+    const ActionTable* at;
+    size_t len;
+    bool operator()( int id, const char* query ) const
+    {
+        return _compareNoCase( at->name(id), query, len ) < 0;
+    }
+};
+
+
+void ActionIndex::clear()
+{
+    _tri.clear();
+    _byName.clear();
+    _indexed = 0;
+}
+
+
+/*
+  Add any actions defined since the last update.  The new entries are
+  sorted separately and merged so appending a few actions is cheap.
+*/
+void ActionIndex::update( const ActionTable& at )
+{
+    int count = at.count();
+    if( _indexed >= count )
+        return;
+
+    size_t triMid  = _tri.size();
+    size_t nameMid = _byName.size();
+    for( int id = _indexed; id < count; ++id )
+    {
+        const char* name = at.name( id );
+        size_t len = strlen( name );
+        for( size_t i = 0; i + 3 <= len; ++i )
+            _tri.push_back( (uint64_t(_trigram( name + i )) << 32) | id );
+        _byName.push_back( id );
+    }
+    _indexed = count;
+
+    std::sort( _tri.begin() + triMid, _tri.end() );
+    std::inplace_merge( _tri.begin(), _tri.begin() + triMid, _tri.end() );
+    _tri.erase( std::unique( _tri.begin(), _tri.end() ), _tri.end() );
+
+    NameLess less = { &at };
+    std::sort( _byName.begin() + nameMid, _byName.end(), less );
+    std::inplace_merge( _byName.begin(), _byName.begin() + nameMid,
+                        _byName.end(), less );
+}
+
+
+/*
+  Return true if name matches the query using the same rules as search().
+*/
+bool ActionIndex::matches( const char* name, const char* query )
+{
+    size_t len = strlen( query );
+    if( len < 3 )
+        return _compareNoCase( name, query, len ) == 0;
+
+    for( ; *name; ++name )
+    {
+        if( _compareNoCase( name, query, len ) == 0 )
+            return true;
+    }
+    return false;
+}
+
+
+/*
+  Set ids to the actions matching query in id order.
+*/
+void ActionIndex::search( const ActionTable& at, const char* query,
+                          std::vector<int>& ids )
+{
+    size_t len = strlen( query );
+
+    update( at );
+    ids.clear();
+
+    if( len < 3 )
+    {
+        PrefixLess less = { &at, len };
+        std::vector<int>::const_iterator it =
+            std::lower_bound( _byName.begin(), _byName.end(), query, less );
+        for( ; it != _byName.end() &&
+               _compareNoCase( at.name(*it), query, len ) == 0; ++it )
+            ids.push_back( *it );
+        std::sort( ids.begin(), ids.end() );
+        return;
+    }
+
+    // Verify the candidates of the rarest trigram in the query.
+    const std::vector<uint64_t>& tri = _tri;
+    std::vector<uint64_t>::const_iterator first, last, it;
+    size_t best = size_t(-1);
+    for( size_t i = 0; i + 3 <= len; ++i )
+    {
+        uint64_t key = uint64_t(_trigram( query + i )) << 32;
+        std::vector<uint64_t>::const_iterator lo, hi;
+        lo = std::lower_bound( tri.begin(), tri.end(), key );
+        hi = std::lower_bound( lo, tri.end(), key + (uint64_t(1) << 32) );
+        if( size_t(hi - lo) < best )
+        {
+            best  = hi - lo;
+            first = lo;
+            last  = hi;
+            if( ! best )
+                return;
+        }
+    }
+
+    for( it = first; it != last; ++it )
+    {
+        int id = int(*it & 0xffffffff);
+        if( matches( at.name( id ), query ) )
+            ids.push_back( id );
+    }
+}
+
+
+//----------------------------------------------------------------------------
+
+
+ActionListModel::ActionListModel( const ActionTable* at, QObject* parent )
+    : QAbstractListModel( parent ), _at( at ), _rows( at->count() ),
+      _filtered( false )
+{
+}
+
+
+int ActionListModel::rowCount( const QModelIndex& parent ) const
+{
+    if( parent.isValid() )
+        return 0;
+    return _filtered ? int(_match.size()) : _rows;
+}
+
+
+QVariant ActionListModel::data( const QModelIndex& index, int role ) const
+{
+    if( index.isValid() && index.row() < rowCount() )
+    {
+        int id = actionAt( index.row() );
+        switch( role )
+        {
+            case Qt::DisplayRole:
+                return QString::fromUtf8( _at->name( id ) );
+            case Qt::ToolTipRole:
+                return QString( "%1 sec" ).arg( _at->duration( id ) );
+            case ROLE_ACTION_ID:
+                return id;
+        }
+    }
+    return QVariant();
+}
+
+
+/*
+  The default itemData() stops before Qt::UserRole, so the action id would
+  not be carried in drag & drop mime data without this.
+*/
+QMap<int, QVariant> ActionListModel::itemData( const QModelIndex& index ) const
+{
+    QMap<int, QVariant> roles;
+    if( index.isValid() && index.row() < rowCount() )
+    {
+        roles.insert( Qt::DisplayRole, data( index, Qt::DisplayRole ) );
+        roles.insert( ROLE_ACTION_ID, actionAt( index.row() ) );
+    }
+    return roles;
+}
+
+
+Qt::ItemFlags ActionListModel::flags( const QModelIndex& index ) const
+{
+    if( ! index.isValid() )
+        return Qt::NoItemFlags;
+    return Qt::ItemIsEnabled | Qt::ItemIsSelectable | Qt::ItemIsDragEnabled;
+}
+
+
+QStringList ActionListModel::mimeTypes() const
+{
+    return QStringList( MIME_ACTION_ID );
+}
+
+
+/*
+  Drag data is the action id as a 32-bit little-endian integer, plus the
+  name as text for other applications.
+*/
+QMimeData* ActionListModel::mimeData( const QModelIndexList& indexes ) const
+{
+    if( indexes.isEmpty() || ! indexes.first().isValid() )
+        return NULL;
+
+    int id = actionAt( indexes.first().row() );
+    char le[4];
+    qToLittleEndian<qint32>( id, le );
+
+    QMimeData* mime = new QMimeData;
+    mime->setData( MIME_ACTION_ID, QByteArray( le, 4 ) );
+    mime->setText( QString::fromUtf8( _at->name( id ) ) );
+    return mime;
+}
+
+
+/*
+  Return the action id of drag & drop data or -1 if it has none.
+*/
+int mimeActionId( const QMimeData* mime, const ActionTable& at )
+{
+    QByteArray data( mime->data( MIME_ACTION_ID ) );
+    if( data.size() == 4 )
+    {
+        int id = qFromLittleEndian<qint32>( data.constData() );
+        if( id >= 0 && id < at.count() )
+            return id;
+    }
+    return -1;
+}
+
+
+/*
+  Insert rows for any actions defined since the last call.
+*/
+void ActionListModel::actionsAdded()
+{
+    int count = _at->count();
+    if( count <= _rows )
+        return;
+
+    if( _filtered )
+    {
+        // Only the new actions need to be checked against the filter.
+        std::vector<int> added;
+        for( int id = _rows; id < count; ++id )
+        {
+            if( ActionIndex::matches( _at->name( id ), _filter.constData() ) )
+                added.push_back( id );
+        }
+        _rows = count;
+        if( ! added.empty() )
+        {
+            int row = _match.size();
+            beginInsertRows( QModelIndex(), row, row + int(added.size()) - 1 );
+            _match.insert( _match.end(), added.begin(), added.end() );
+            endInsertRows();
+        }
+    }
+    else
+    {
+        beginInsertRows( QModelIndex(), _rows, count - 1 );
+        _rows = count;
+        endInsertRows();
+    }
+}
+
+
+/*
+  Call when the ActionTable has been replaced.
+*/
+void ActionListModel::reset()
+{
+    beginResetModel();
+    _index.clear();
+    _rows = _at->count();
+    if( _filtered )
+        _index.search( *_at, _filter.constData(), _match );
+    endResetModel();
+}
+
+
+/*
+  Show only the actions matching the text (see ActionIndex).  When the
+  text only extends the previous filter the current matches are narrowed
+  rather than searching the index again.
+*/
+void ActionListModel::setFilter( const QString& text )
+{
+    QByteArray query( text.trimmed().toUtf8() );
+    if( query == _filter && _filtered == ! query.isEmpty() )
+        return;
+
+    beginResetModel();
+    if( query.isEmpty() )
+    {
+        _filtered = false;
+        _match.clear();
+    }
+    else
+    {
+        bool narrow = _filtered && (_filter.size() < 3) == (query.size() < 3)
+                      && ((query.size() < 3) ? query.startsWith( _filter )
+                                             : query.contains( _filter ));
+        if( narrow )
+        {
+            std::vector<int>::iterator out = _match.begin();
+            std::vector<int>::const_iterator it;
+            for( it = _match.begin(); it != _match.end(); ++it )
+            {
+                if( ActionIndex::matches( _at->name(*it), query.constData() ) )
+                    *out++ = *it;
+            }
+            _match.erase( out, _match.end() );
+        }
+        else
+            _index.search( *_at, query.constData(), _match );
+        _filtered = true;
+    }
+    _filter = query;
+    endResetModel();
+}
+
+
+//----------------------------------------------------------------------------
+// Action library import
+
+
+static const char* _skipSpace( const char* it, const char* end )
+{
+    while( it != end && (*it == ' ' || *it == '\t' || *it == '\r') )
+        ++it;
+    return it;
+}
+
+
+static void _putUtf8( std::string& out, uint32_t c )
+{
+    if( c < 0x80 )
+        out.push_back( char(c) );
+    else if( c < 0x800 )
+    {
+        out.push_back( char(0xc0 | (c >> 6)) );
+        out.push_back( char(0x80 | (c & 0x3f)) );
+    }
+    else if( c < 0x10000 )
+    {
+        out.push_back( char(0xe0 | (c >> 12)) );
+        out.push_back( char(0x80 | ((c >> 6) & 0x3f)) );
+        out.push_back( char(0x80 | (c & 0x3f)) );
+    }
+    else
+    {
+        out.push_back( char(0xf0 | (c >> 18)) );
+        out.push_back( char(0x80 | ((c >> 12) & 0x3f)) );
+        out.push_back( char(0x80 | ((c >> 6) & 0x3f)) );
+        out.push_back( char(0x80 | (c & 0x3f)) );
+    }
+}
+
+
+static bool _hex4( const char* it, const char* end, uint32_t& c )
+{
+    if( end - it < 4 )
+        return false;
+    c = 0;
+    for( int i = 0; i < 4; ++i )
+    {
+        char ch = it[i];
+        c <<= 4;
+        if( ch >= '0' && ch <= '9' )
+            c |= ch - '0';
+        else if( ch >= 'a' && ch <= 'f' )
+            c |= ch - 'a' + 10;
+        else if( ch >= 'A' && ch <= 'F' )
+            c |= ch - 'A' + 10;
+        else
+            return false;
+    }
+    return true;
+}
+
+
+/*
+  Parse a JSON string from just after the opening quote.
+  Return a pointer past the closing quote or NULL if it is malformed.
+*/
+static const char* _jsonString( const char* it, const char* end,
+                                std::string& out )
+{
+    out.clear();
+    while( it != end )
+    {
+        char ch = *it++;
+        if( ch == '"' )
+            return it;
+        if( ch == '\\' )
+        {
+            if( it == end )
+                return NULL;
+            ch = *it++;
+            switch( ch )
+            {
+                case 'b': ch = '\b'; break;
+                case 'f': ch = '\f'; break;
+                case 'n': ch = '\n'; break;
+                case 'r': ch = '\r'; break;
+                case 't': ch = '\t'; break;
+                case 'u':
+                {
+                    uint32_t c, lo;
+                    if( ! _hex4( it, end, c ) )
+                        return NULL;
+                    it += 4;
+                    if( c >= 0xd800 && c < 0xdc00 && end - it >= 6 &&
+                        it[0] == '\\' && it[1] == 'u' &&
+                        _hex4( it + 2, end, lo ) &&
+                        lo >= 0xdc00 && lo < 0xe000 )
+                    {
+                        c = 0x10000 + ((c - 0xd800) << 10) + (lo - 0xdc00);
+                        it += 6;
+                    }
+                    _putUtf8( out, c );
+                }
+                    continue;
+            }
+        }
+        out.push_back( ch );
+    }
+    return NULL;
+}
+
+
+/*
+  Parse a number.  Return a pointer past it or NULL if there is none.
+*/
+static const char* _number( const char* it, const char* end, double& num )
+{
+    char buf[ 32 ];
+    char* stop;
+    size_t len = std::min( size_t(end - it), sizeof(buf) - 1 );
+    memcpy( buf, it, len );
+    buf[ len ] = '\0';
+    num = strtod( buf, &stop );
+    return (stop == buf) ? NULL : it + (stop - buf);
+}
+
+
+/*
+  Skip over any JSON value.  Return NULL if it is malformed.
+*/
+static const char* _jsonSkip( const char* it, const char* end,
+                              std::string& tmp )
+{
+    int depth = 0;
+    do
+    {
+        it = _skipSpace( it, end );
+        if( it == end )
+            return NULL;
+        switch( *it )
+        {
+            case '"':
+                it = _jsonString( it + 1, end, tmp );
+                if( ! it )
+                    return NULL;
+                break;
+            case '{':
+            case '[':
+                ++depth;
+                ++it;
+                break;
+            case '}':
+            case ']':
+                if( --depth < 0 )
+                    return NULL;
+                ++it;
+                break;
+            default:
+                // Number, literal, comma or colon.
+                ++it;
+                while( it != end && ! strchr( "\"{}[],: \t\r", *it ) )
+                    ++it;
+                break;
+        }
+    }
+    while( depth );
+    return it;
+}
+
+
+/*
+  Parse an object such as {"name": "Attack", "duration": 5}.
+  The duration may also be named "seconds" or "dur".
+*/
+static bool _parseJsonLine( const char* it, const char* end,
+                            std::string& name, double& dur,
+                            std::string& key )
+{
+    bool haveName = false;
+    bool haveDur = false;
+
+    it = _skipSpace( it, end );
+    if( it == end || *it != '{' )
+        return false;
+    it = _skipSpace( it + 1, end );
+    if( it != end && *it == '}' )
+        return false;
+
+    while( it != end )
+    {
+        if( *it != '"' || ! (it = _jsonString( it + 1, end, key )) )
+            return false;
+        it = _skipSpace( it, end );
+        if( it == end || *it != ':' )
+            return false;
+        it = _skipSpace( it + 1, end );
+        if( it == end )
+            return false;
+
+        if( key == "name" && *it == '"' )
+        {
+            it = _jsonString( it + 1, end, name );
+            haveName = true;
+        }
+        else if( key == "duration" || key == "seconds" || key == "dur" )
+        {
+            it = _number( it, end, dur );
+            haveDur = true;
+        }
+        else
+            it = _jsonSkip( it, end, key );
+        if( ! it )
+            return false;
+
+        it = _skipSpace( it, end );
+        if( it == end )
+            return false;
+        if( *it == '}' )
+            return haveName && haveDur;
+        if( *it != ',' )
+            return false;
+        it = _skipSpace( it + 1, end );
+    }
+    return false;
+}
+
+
+/*
+  Parse a line such as "Aimed Shot",7 or Attack,5.  Quoted names may
+  contain commas and doubled quotes.
+*/
+static bool _parseCsvLine( const char* it, const char* end,
+                           std::string& name, double& dur )
+{
+    name.clear();
+    it = _skipSpace( it, end );
+    if( it != end && *it == '"' )
+    {
+        for( ++it; ; ++it )
+        {
+            if( it == end )
+                return false;
+            if( *it == '"' )
+            {
+                if( it + 1 == end || it[1] != '"' )
+                    break;
+                ++it;
+            }
+            name.push_back( *it );
+        }
+        it = _skipSpace( it + 1, end );
+    }
+    else
+    {
+        const char* start = it;
+        while( it != end && *it != ',' )
+            ++it;
+        const char* last = it;
+        while( last != start && (last[-1] == ' ' || last[-1] == '\t') )
+            --last;
+        name.assign( start, last );
+    }
+
+    if( it == end || *it != ',' )
+        return false;
+    it = _skipSpace( it + 1, end );
+    return _number( it, end, dur ) != NULL;
+}
+
+
+/*
+  Define the actions listed in a CSV or JSON lines file.  Each line holds
+  a name & duration in seconds.  Names which are already defined have
+  their duration updated.
+
+  Return the number of new actions or -1 if the file cannot be read.
+  If skipped is not NULL it is set to the number of malformed lines.
+*/
+int importActions( const QString& file, ActionTable& at, int* skipped )
+{
+    QFile fp( file );
+    if( ! fp.open( QIODevice::ReadOnly ) )
+        return -1;
+
+    qint64 size = fp.size();
+    const char* it = "";
+    if( size > 0 )
+    {
+        it = (const char*) fp.map( 0, size );
+        if( ! it )
+            return -1;
+    }
+    const char* end = it + size;
+
+    // Skip any UTF-8 byte order mark.
+    if( size >= 3 && memcmp( it, "\xef\xbb\xbf", 3 ) == 0 )
+        it += 3;
+
+    // Reserve as if every line is a new action so the fill never grows.
+    size_t lines = std::count( it, end, '\n' ) + 1;
+    at.reserve( at.count() + lines, at.strings().size() + (end - it) );
+
+    const char* eol;
+    const char* first = _skipSpace( it, end );
+    bool json = (first != end && *first == '{');
+    std::string name, key;
+    double dur;
+    int added = 0;
+    int bad = 0;
+    bool firstRow = true;
+
+    for( ; it < end; it = eol + 1 )
+    {
+        eol = (const char*) memchr( it, '\n', end - it );
+        if( ! eol )
+            eol = end;
+
+        const char* cp = _skipSpace( it, eol );
+        if( cp != eol && *cp != '#' )
+        {
+            bool ok = json ? _parseJsonLine( cp, eol, name, dur, key )
+                           : _parseCsvLine( cp, eol, name, dur );
+            if( ok && ! name.empty() && dur == dur )
+            {
+                int sec = int(lround( std::min( std::max( dur, double(DUR_MIN) ),
+                                                double(DUR_MAX) ) ));
+                const char* nb = name.data();
+                const char* ne = nb + name.size();
+                int id = at.actionId( nb, ne );
+                if( id < 0 )
+                {
+                    at.defineAction( nb, ne, sec );
+                    ++added;
+                }
+                else
+                    at.setDuration( id, sec );
+            }
+            else if( json || ! firstRow )
+                ++bad;      // The first CSV row may be a header.
+            firstRow = false;
+        }
+    }
+
+    if( skipped )
+        *skipped = bad;
+    return added;
+}
@@ -0,0 +1,84 @@
+#ifndef ACTIONLIST_H
+#define ACTIONLIST_H
+/*
+  Action Timeline
+  Copyright 2020 Karl Robillard
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <QAbstractListModel>
+#include "TimelineModel.h"
+
+#define ROLE_ACTION_ID  Qt::UserRole
+#define MIME_ACTION_ID  "application/x-action-tl-id"
+
+/*
+  Index of ActionTable names for type-ahead search.  Queries shorter than
+  three characters match name prefixes using a name sorted id array.
+  Longer queries match anywhere in the name using a sorted array of
+  (trigram, id) pairs.  Matching ignores ASCII case.
+*/
+class ActionIndex
+{
+public:
+    ActionIndex() : _indexed(0) {}
+    void clear();
+    void update( const ActionTable& );
+    void search( const ActionTable&, const char* query,
+                 std::vector<int>& ids );
+    static bool matches( const char* name, const char* query );
+
+private:
+    std::vector<uint64_t> _tri;     // (trigram << 32) | id
+    std::vector<int> _byName;       // Ids sorted by lowercase name.
+    int _indexed;                   // Number of actions in the index.
+};
+
+/*
+  List model presenting the entries of an ActionTable.  The table only
+  grows, so new actions are announced with actionsAdded().
+*/
+class ActionListModel : public QAbstractListModel
+{
+public:
+    ActionListModel( const ActionTable*, QObject* parent = NULL );
+    int rowCount( const QModelIndex& parent = QModelIndex() ) const;
+    QVariant data( const QModelIndex&, int role = Qt::DisplayRole ) const;
+    QMap<int, QVariant> itemData( const QModelIndex& ) const;
+    Qt::ItemFlags flags( const QModelIndex& ) const;
+    QStringList mimeTypes() const;
+    QMimeData* mimeData( const QModelIndexList& ) const;
+    void actionsAdded();
+    void reset();
+    void setFilter( const QString& );
+
+private:
+    int actionAt( int row ) const
+    {
+        return _filtered ? _match[ row ] : row;
+    }
+
+    const ActionTable* _at;
+    ActionIndex _index;
+    std::vector<int> _match;        // Ids of actions matching _filter.
+    QByteArray _filter;
+    int _rows;
+    bool _filtered;
+};
+
+int importActions( const QString& file, ActionTable&, int* skipped );
+int mimeActionId( const QMimeData*, const ActionTable& );
+
+#endif //ACTIONLIST_H
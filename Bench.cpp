@@ -0,0 +1,332 @@
+/*
+  Action Timeline
+  Copyright 2020 Karl Robillard
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+/*
+  action-tl-bench: Timing of the dice, action table & timeline hot paths.
+
+  Each benchmark reports the time & heap allocations per operation.  The
+  timeline is painted with the offscreen platform so no display is needed.
+  Arguments select the benchmarks whose names contain any of them.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QImage>
+#include "Timeline.h"
+#include "evalDice.c"
+
+
+//----------------------------------------------------------------------------
+// Allocation counting
+
+
+static uint64_t _allocCount = 0;
+
+void* operator new( size_t size )
+{
+    ++_allocCount;
+    void* ptr = malloc( size ? size : 1 );
+    if( ! ptr )
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[]( size_t size )
+{
+    return operator new( size );
+}
+
+void operator delete( void* ptr ) noexcept
+{
+    free( ptr );
+}
+
+void operator delete[]( void* ptr ) noexcept
+{
+    free( ptr );
+}
+
+void operator delete( void* ptr, size_t ) noexcept
+{
+    free( ptr );
+}
+
+void operator delete[]( void* ptr, size_t ) noexcept
+{
+    free( ptr );
+}
+
+
+//----------------------------------------------------------------------------
+
+
+static int _argc;
+static char** _argv;
+
+/*
+  Return true if the benchmark should be run.
+*/
+static bool selected( const char* name )
+{
+    if( _argc < 2 )
+        return true;
+    for( int i = 1; i < _argc; ++i )
+    {
+        if( strstr( name, _argv[i] ) )
+            return true;
+    }
+    return false;
+}
+
+
+struct Bench
+{
+    QElapsedTimer timer;
+    uint64_t allocStart;
+
+    void start()
+    {
+        allocStart = _allocCount;
+        timer.start();
+    }
+
+    void report( const char* name, uint64_t ops )
+    {
+        qint64 ns = timer.nsecsElapsed();
+        uint64_t allocs = _allocCount - allocStart;
+        printf( "%-36s %12.1f ns/op %10.2f allocs/op\n", name,
+                double(ns) / ops, double(allocs) / ops );
+    }
+};
+
+
+static void benchDice()
+{
+    static const char* spec[] =
+    {
+        "d20", "3d6+2", "4d6dl1", "2d20kh1+5", "3d6!", "d20r1", "(d8+2)*2",
+        "10d10"
+    };
+    const int specCount = sizeof(spec) / sizeof(spec[0]);
+    const int iter = 200000;
+    DiceRng rng;
+    DiceOp prog[ DICE_OP_MAX ];
+    char name[ 64 ];
+    Bench b;
+    int sum = 0;
+
+    diceSeed( &rng, 1, 1 );
+    for( int s = 0; s < specCount; ++s )
+    {
+        snprintf( name, sizeof(name), "evalDice %s", spec[s] );
+        if( selected( name ) )
+        {
+            b.start();
+            for( int i = 0; i < iter; ++i )
+                sum += evalDice( &rng, spec[s], NULL, NULL );
+            b.report( name, iter );
+        }
+
+        snprintf( name, sizeof(name), "evalDiceProgram %s", spec[s] );
+        if( selected( name ) )
+        {
+            int len = compileDice( spec[s], prog );
+            b.start();
+            for( int i = 0; i < iter; ++i )
+                sum += evalDiceProgram( &rng, prog, len, NULL, NULL );
+            b.report( name, iter );
+        }
+    }
+
+    if( sum == 1 )      // Keep the results live.
+        printf( "\n" );
+}
+
+
+static void benchActionTable()
+{
+    static const int sizes[3] = { 10, 1000, 100000 };
+    char name[ 64 ];
+    Bench b;
+
+    for( int s = 0; s < 3; ++s )
+    {
+        int count = sizes[s];
+        int found = 0;
+        int i;
+
+        std::vector<std::string> names( count );
+        for( i = 0; i < count; ++i )
+        {
+            snprintf( name, sizeof(name), "Action %d", i );
+            names[i] = name;
+        }
+
+        ActionTable at;
+        snprintf( name, sizeof(name), "ActionTable::defineAction %d", count );
+        bool sel = selected( name );
+        if( sel )
+            b.start();
+        for( i = 0; i < count; ++i )
+        {
+            const std::string& str = names[i];
+            at.defineAction( str.c_str(), str.c_str() + str.size(), 3 );
+        }
+        if( sel )
+            b.report( name, count );
+
+        snprintf( name, sizeof(name), "ActionTable::actionId %d", count );
+        if( selected( name ) )
+        {
+            int iter = (count < 100000) ? 100000 : count;
+            b.start();
+            for( i = 0; i < iter; ++i )
+                found += at.actionId( names[ i % count ].c_str() ) >= 0;
+            b.report( name, iter );
+        }
+
+        if( found == -1 )
+            printf( "\n" );
+    }
+}
+
+
+/*
+  Fill the model with subjects each holding actions queued back to back.
+*/
+static void fillModel( TimelineModel& model, const ActionTable& at,
+                       int subjects, int actions )
+{
+    model.clear();
+    for( int i = 0; i < subjects; ++i )
+    {
+        model.addSubject( "Subject" );
+        for( int n = 0; n < actions; ++n )
+        {
+            int id = (i + n) % at.count();
+            model.appendAction( i, id, float(at.duration( id )) );
+        }
+    }
+}
+
+
+static void benchTimeline()
+{
+    static const int shape[][2] =
+    {
+        { 10, 10 }, { 100, 10 }, { 100, 100 }, { 500, 20 }
+    };
+    ActionTable at;
+    TimelineModel model;
+    char name[ 64 ];
+    Bench b;
+
+    at.defineBuiltins();
+    Timeline tl( &at, &model );
+
+    for( size_t s = 0; s < sizeof(shape) / sizeof(shape[0]); ++s )
+    {
+        int subjects = shape[s][0];
+        int actions  = shape[s][1];
+
+        snprintf( name, sizeof(name), "Timeline::appendAction %dx%d",
+                  subjects, actions );
+        if( selected( name ) )
+        {
+            model.clear();
+            tl.modelReset();
+            for( int i = 0; i < subjects; ++i )
+                tl.addSubject( "Subject", false );
+            b.start();
+            for( int n = 0; n < actions; ++n )
+            {
+                for( int i = 0; i < subjects; ++i )
+                {
+                    tl.select( i );
+                    tl.appendAction( (i + n) % at.count() );
+                }
+            }
+            b.report( name, subjects * actions );
+        }
+
+        snprintf( name, sizeof(name), "Timeline::advance %dx%d",
+                  subjects, actions );
+        if( selected( name ) )
+        {
+            fillModel( model, at, subjects, actions );
+            tl.modelReset();
+            int turns = actions;    // Less than the queued time.
+            b.start();
+            for( int t = 0; t < turns; ++t )
+                tl.advance( 1 );
+            b.report( name, turns );
+        }
+
+        snprintf( name, sizeof(name), "Timeline paint %dx%d",
+                  subjects, actions );
+        if( selected( name ) )
+        {
+            fillModel( model, at, subjects, actions );
+            tl.modelReset();
+            tl.resize( tl.sizeHint() );
+            const int iter = 20;
+            b.start();
+            for( int i = 0; i < iter; ++i )
+                tl.snapshot();
+            b.report( name, iter );
+        }
+
+        // A window sized region from the middle of the timeline as would
+        // be painted when scrolling.
+        snprintf( name, sizeof(name), "Timeline paint viewport %dx%d",
+                  subjects, actions );
+        if( selected( name ) )
+        {
+            fillModel( model, at, subjects, actions );
+            tl.modelReset();
+            tl.resize( tl.sizeHint() );
+            QRect view( 0, tl.height() / 2, tl.width(), 600 );
+            QImage img( view.size(), QImage::Format_RGB32 );
+            const int iter = 100;
+            b.start();
+            for( int i = 0; i < iter; ++i )
+                tl.render( &img, QPoint(), QRegion( view ) );
+            b.report( name, iter );
+        }
+    }
+}
+
+
+int main( int argc, char** argv )
+{
+    if( ! qEnvironmentVariableIsSet( "QT_QPA_PLATFORM" ) )
+        qputenv( "QT_QPA_PLATFORM", "offscreen" );
+    QApplication app( argc, argv );
+
+    _argc = argc;
+    _argv = argv;
+
+    benchDice();
+    benchActionTable();
+    benchTimeline();
+    return 0;
+}
@@ -0,0 +1,419 @@
+/*
+  Action Timeline
+  Copyright 2020 Karl Robillard
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Journal.h"
+
+
+/*
+  Set the maximum number of commands kept.  Zero disables the journal.
+*/
+void Journal::setLimit( int commands )
+{
+    _limit = (commands < 0) ? 0 : commands;
+    if( _limit )
+        trim();
+    else
+        clear();
+}
+
+
+void Journal::clear()
+{
+    _rec.clear();
+    _pos = 0;
+    _commands = 0;
+}
+
+
+void Journal::beginGroup()
+{
+    if( _depth++ == 0 )
+        _linked = false;
+}
+
+
+void Journal::endGroup()
+{
+    if( --_depth == 0 )
+        _linked = false;
+}
+
+
+/*
+  Append a record, discarding any which could be redone.
+  Return NULL if the journal is disabled.
+*/
+Journal::Record* Journal::push( int type, int subject, int arg )
+{
+    if( ! _limit )
+        return NULL;
+
+    while( _rec.size() > _pos )
+    {
+        if( ! _rec.back().linked )
+            --_commands;
+        _rec.pop_back();
+    }
+
+    _rec.push_back( Record() );
+    Record& rec = _rec.back();
+    rec.type    = type;
+    rec.linked  = _linked;
+    rec.subject = subject;
+    rec.arg     = arg;
+    ++_pos;
+
+    if( _depth )
+        _linked = true;
+    if( ! rec.linked )
+    {
+        ++_commands;
+        trim();
+    }
+    return &_rec.back();
+}
+
+
+/*
+  Drop the oldest commands until no more than _limit remain.
+*/
+void Journal::trim()
+{
+    while( _commands > _limit )
+    {
+        do
+        {
+            _rec.pop_front();
+            --_pos;
+        }
+        while( ! _rec.empty() && _rec.front().linked );
+        --_commands;
+    }
+}
+
+
+/*
+  Save the name of subject i before it is changed.
+*/
+void Journal::saveName( const TimelineModel& model, int i )
+{
+    Record* rec = push( NAME, i );
+    if( rec )
+        rec->name = model.subjectName( i );
+}
+
+
+void Journal::saveInitiative( const TimelineModel& model, int i )
+{
+    push( INIT, i, model.initiative( i ) );
+}
+
+
+void Journal::saveTokens( const TimelineModel& model, int i )
+{
+    Record* rec = push( TOKENS, i );
+    if( rec )
+        rec->tokens = model.tokens( i );
+}
+
+
+/*
+  Note an action is about to be appended to subject i.
+*/
+void Journal::saveAppend( const TimelineModel& model, int i )
+{
+    push( SPAN_TAKE, i, model.spans( i ).size() );
+}
+
+
+/*
+  Save action n of subject i before it is removed.
+*/
+void Journal::saveRemoveAction( const TimelineModel& model, int i, int n )
+{
+    Record* rec = push( SPAN_PUT, i, n );
+    if( rec )
+        rec->spans.insert( 0, model.spans( i ), n, n + 1 );
+}
+
+
+void Journal::saveDuration( const TimelineModel& model, int i, int n )
+{
+    Record* rec = push( DURATION, i, n );
+    if( rec )
+        rec->duration = model.duration( i, n );
+}
+
+
+/*
+  Save the label text & flags of action n of subject i.
+*/
+void Journal::saveLabel( const TimelineModel& model, int i, int n )
+{
+    Record* rec = push( LABEL, i, n );
+    if( rec )
+    {
+        const SpanList& sl = model.spans( i );
+        rec->name  = sl.text[n];
+        rec->flags = sl.flags[n];
+    }
+}
+
+
+/*
+  Note that subject i has been added.
+*/
+void Journal::saveAdded( int i )
+{
+    push( REMOVE, i );
+}
+
+
+/*
+  Save subject i before it is removed.
+*/
+void Journal::saveRemove( const TimelineModel& model, int i )
+{
+    Record* rec = push( INSERT, i, model.initiative( i ) );
+    if( rec )
+    {
+        rec->name   = model.subjectName( i );
+        rec->tokens = model.tokens( i );
+        rec->spans  = model.spans( i );
+    }
+}
+
+
+/*
+  Note a subject is about to be moved from one index to another.
+*/
+void Journal::saveMove( int from, int to )
+{
+    push( MOVE, from, to );
+}
+
+
+/*
+  Save the start time before TimelineModel::setStartTime() is called.
+*/
+void Journal::saveStartTime( const TimelineModel& model )
+{
+    push( SHIFT, 0, model.startTime() );
+}
+
+
+/*
+  Note that TimelineModel::advance( sec ) is about to be called.
+*/
+void Journal::saveAdvance( const TimelineModel& model, int sec )
+{
+    Record* rec = push( ADVANCE, 0, sec );
+    if( rec )
+        saveHeads( model, *rec );
+}
+
+
+/*
+  Save the span heads & timed tokens of the subjects which will be changed
+  by advancing rec.arg seconds.  Spans are only copied when the advance
+  will erase them, which is at most once every TRIM_MIN actions.
+*/
+void Journal::saveHeads( const TimelineModel& model, Record& rec )
+{
+    int count = model.subjectCount();
+    int head;
+    bool trim;
+
+    rec.heads.clear();
+    rec.spans = SpanList();
+    for( int i = 0; i < count; ++i )
+    {
+        if( ! model.advanceChanges( i, rec.arg ) )
+            continue;
+
+        const SpanList& sl = model.spans( i );
+        const TokenSet& ts = model.tokens( i );
+        rec.heads.push_back( HeadDelta() );
+        HeadDelta& hd = rec.heads.back();
+
+        head = model.advanceHead( i, rec.arg, trim );
+        hd.subject = i;
+        hd.head    = sl.head;
+        hd.erased  = trim ? head : 0;
+        if( trim )
+            rec.spans.insert( rec.spans.size(), sl, 0, head );
+
+        hd.timed = ts.timed();
+        if( hd.timed )
+            hd.tokens = ts;
+    }
+}
+
+
+/*
+  Undo an ADVANCE record.
+*/
+void Journal::rewind( TimelineModel& model, const Record& rec )
+{
+    std::vector<HeadDelta>::const_iterator it;
+    int first = 0;
+
+    for( it = rec.heads.begin(); it != rec.heads.end(); ++it )
+    {
+        model.rewindSpans( it->subject, it->head, rec.spans, first,
+                           it->erased );
+        first += it->erased;
+        if( it->timed )
+            model.setTokens( it->subject, it->tokens );
+    }
+
+    int t = model.startTime() - rec.arg;
+    model.swapStartTime( t );
+}
+
+
+/*
+  Exchange the record state with the model.  Applying a record twice
+  leaves both unchanged.  Advance records are instead rewound or
+  advanced again.
+*/
+void Journal::apply( TimelineModel& model, Record& rec, bool undoing )
+{
+    std::string str;
+    TokenSet tokens;
+    float dur;
+    int t;
+
+    switch( rec.type )
+    {
+        case NAME:
+            str = model.subjectName( rec.subject );
+            model.setSubjectName( rec.subject, rec.name );
+            rec.name.swap( str );
+            break;
+
+        case INIT:
+            t = model.initiative( rec.subject );
+            model.setInitiative( rec.subject, rec.arg );
+            rec.arg = t;
+            break;
+
+        case TOKENS:
+            tokens = model.tokens( rec.subject );
+            model.setTokens( rec.subject, rec.tokens );
+            rec.tokens = tokens;
+            break;
+
+        case SPAN_TAKE:
+            model.takeSpan( rec.subject, rec.arg, rec.spans );
+            rec.type = SPAN_PUT;
+            break;
+
+        case SPAN_PUT:
+            model.putSpan( rec.subject, rec.arg, rec.spans );
+            rec.type = SPAN_TAKE;
+            break;
+
+        case DURATION:
+            dur = model.duration( rec.subject, rec.arg );
+            model.setDuration( rec.subject, rec.arg, rec.duration );
+            rec.duration = dur;
+            break;
+
+        case LABEL:
+        {
+            const SpanList& sl = model.spans( rec.subject );
+            str = sl.text[ rec.arg ];
+            t   = sl.flags[ rec.arg ];
+            model.setLabel( rec.subject, rec.arg, rec.name, rec.flags );
+            rec.name.swap( str );
+            rec.flags = uint8_t(t);
+        }
+            break;
+
+        case INSERT:
+            model.insertSubject( rec.subject, rec.name, rec.arg, rec.tokens,
+                                 rec.spans );
+            rec.type = REMOVE;
+            break;
+
+        case REMOVE:
+            model.takeSubject( rec.subject, rec.name, rec.arg, rec.tokens,
+                               rec.spans );
+            rec.type = INSERT;
+            break;
+
+        case MOVE:
+            model.moveSubject( rec.arg, rec.subject );
+            std::swap( rec.subject, rec.arg );
+            break;
+
+        case SHIFT:
+            t = model.startTime();
+            model.setStartTime( rec.arg );
+            rec.arg = t;
+            break;
+
+        case ADVANCE:
+            if( undoing )
+            {
+                rewind( model, rec );
+            }
+            else
+            {
+                saveHeads( model, rec );
+                model.advance( rec.arg );
+            }
+            break;
+    }
+}
+
+
+/*
+  Revert the last command.  Return false if there is nothing to undo.
+*/
+bool Journal::undo( TimelineModel& model )
+{
+    if( ! _pos )
+        return false;
+    do
+    {
+        --_pos;
+        apply( model, _rec[ _pos ], true );
+    }
+    while( _pos && _rec[ _pos ].linked );
+    return true;
+}
+
+
+/*
+  Reapply the last undone command.  Return false if there is nothing to
+  redo.
+*/
+bool Journal::redo( TimelineModel& model )
+{
+    if( _pos == _rec.size() )
+        return false;
+    do
+    {
+        apply( model, _rec[ _pos ], false );
+        ++_pos;
+    }
+    while( _pos < _rec.size() && _rec[ _pos ].linked );
+    return true;
+}
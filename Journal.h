@@ -0,0 +1,118 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+/*
+  Action Timeline
+  Copyright 2020 Karl Robillard
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <deque>
+#include "TimelineModel.h"
+
+/*
+  Undo/redo history of TimelineModel edits.  Before an edit the parts of
+  the model it will change are saved with one of the save methods.  Only
+  the changed field or span is kept, and undo swaps it with the model, so
+  the same record then holds the state needed to redo.  Advance records
+  hold the old span heads & token durations and redo advances again.
+
+  Records saved between beginGroup() & endGroup() are undone as a single
+  command.  At most limit() commands are kept.
+*/
+class Journal
+{
+public:
+    Journal() : _pos(0), _commands(0), _limit(100), _depth(0),
+                _linked(false) {}
+    int  limit() const { return _limit; }
+    void setLimit( int commands );
+    void clear();
+    bool canUndo() const { return _pos > 0; }
+    bool canRedo() const { return _pos < _rec.size(); }
+    void beginGroup();
+    void endGroup();
+
+    void saveName( const TimelineModel&, int i );
+    void saveInitiative( const TimelineModel&, int i );
+    void saveTokens( const TimelineModel&, int i );
+    void saveAppend( const TimelineModel&, int i );
+    void saveRemoveAction( const TimelineModel&, int i, int n );
+    void saveDuration( const TimelineModel&, int i, int n );
+    void saveLabel( const TimelineModel&, int i, int n );
+    void saveAdded( int i );
+    void saveRemove( const TimelineModel&, int i );
+    void saveMove( int from, int to );
+    void saveStartTime( const TimelineModel& );
+    void saveAdvance( const TimelineModel&, int sec );
+
+    bool undo( TimelineModel& );
+    bool redo( TimelineModel& );
+
+private:
+    enum RecordType
+    {
+        NAME,           // Subject name.
+        INIT,           // Subject initiative (arg).
+        TOKENS,         // Subject tokens.
+        SPAN_TAKE,      // Index of action to remove (arg).
+        SPAN_PUT,       // Action to insert at index (arg).
+        DURATION,       // Action index (arg) & duration.
+        LABEL,          // Action index (arg), text (name) & flags.
+        INSERT,         // Subject to insert at index.
+        REMOVE,         // Index of subject to remove.
+        MOVE,           // Subject index & destination (arg).
+        SHIFT,          // Start time moving spans (arg).
+        ADVANCE         // Seconds advanced (arg) & heads.
+    };
+
+    // Subject state changed by TimelineModel::advance().
+    struct HeadDelta
+    {
+        int subject;
+        int head;           // SpanList::head before the advance.
+        int erased;         // Number of spans erased, kept in Record::spans.
+        bool timed;         // True if tokens holds the token durations.
+        TokenSet tokens;
+    };
+
+    struct Record
+    {
+        uint8_t type;
+        uint8_t flags;      // Action flags for LABEL.
+        bool linked;        // Part of the same command as the previous.
+        int subject;
+        int arg;            // Subject initiative for INSERT & REMOVE.
+        float duration;
+        std::string name;
+        TokenSet tokens;
+        SpanList spans;
+        std::vector<HeadDelta> heads;
+    };
+
+    Record* push( int type, int subject, int arg = 0 );
+    void apply( TimelineModel&, Record&, bool undoing );
+    void saveHeads( const TimelineModel&, Record& );
+    void rewind( TimelineModel&, const Record& );
+    void trim();
+
+    std::deque<Record> _rec;
+    size_t _pos;            // Records before this are undone by undo().
+    int _commands;          // Number of unlinked records.
+    int _limit;
+    int _depth;
+    bool _linked;
+};
+
+#endif //JOURNAL_H
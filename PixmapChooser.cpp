@@ -1,52 +1,232 @@
 #include "PixmapChooser.h"
+#include <algorithm>
+#include <QElapsedTimer>
 #include <QMouseEvent>
 #include <QPainter>
+#include <QThread>
 
 
-PixmapChooser::PixmapChooser( QWidget* parent )
-    : QWidget(parent), _cols(4), _sel(-1)
+class AtlasLoader : public QThread
 {
-    _dim.w = _dim.h = 16;
-    setSizePolicy( QSizePolicy::Fixed, QSizePolicy::Fixed );
+public:
+    AtlasLoader( PixmapAtlas* atlas ) : _atlas(atlas) {}
+protected:
+    void run() { _atlas->decode(); }
+private:
+    PixmapAtlas* _atlas;
+};
+
+
+PixmapAtlas::~PixmapAtlas()
+{
+    if( _loader )
+    {
+        _loader->wait();
+        delete _loader;
+    }
+}
+
+
+/*
+  Load images into the atlas, which is arranged in a grid of cols columns.
+  The cell size is taken from the first image.  Return the number of images
+  loaded.
+*/
+int PixmapAtlas::load( const char** files, int count, int cols )
+{
+    finish();
+    _files = files;
+    _count = count;
+    _cols = (count < cols) ? count : cols;
+    decode();
+    finish();
+    return _loaded;
+}
+
+
+/*
+  Begin loading images on a background thread.  The files array must
+  remain valid until the atlas is used.
+*/
+void PixmapAtlas::loadAsync( const char** files, int count, int cols )
+{
+    finish();
+    _files = files;
+    _count = count;
+    _cols = (count < cols) ? count : cols;
+    _loader = new AtlasLoader( this );
+    _loader->start( QThread::LowPriority );
+}
+
+
+/*
+  Decode the files into _image.  Any which cannot be read are left blank.
+  This only touches QImage so it is safe to run on any thread.
+*/
+void PixmapAtlas::decode()
+{
+    QElapsedTimer timer;
+    QImage img;
+    int i;
+
+    timer.start();
+    _loaded = 0;
+    _dim = QSize();
+    for( i = 0; i < _count; ++i )
+    {
+        if( img.load( _files[i] ) )
+            break;
+    }
+    if( i == _count )
+    {
+        _image = QImage();
+        _decodeMs = int(timer.elapsed());
+        return;
+    }
+
+    _dim = img.size();
+    _image = QImage( _dim.width() * _cols,
+                     _dim.height() * ((_count + _cols - 1) / _cols),
+                     QImage::Format_ARGB32_Premultiplied );
+    _image.fill( Qt::transparent );
+
+    QPainter p( &_image );
+    p.setCompositionMode( QPainter::CompositionMode_Source );
+    for( ; i < _count; ++i )
+    {
+        if( _loaded && ! img.load( _files[i] ) )
+            continue;
+        QRect r( source( i ) );
+        p.drawImage( r.topLeft(), img.scaled( r.size() ) );
+        ++_loaded;
+    }
+    p.end();
+    _decodeMs = int(timer.elapsed());
+}
+
+
+/*
+  Return true if the images have been decoded.
+*/
+bool PixmapAtlas::ready() const
+{
+    return ! _loader || _loader->isFinished();
 }
 
-void PixmapChooser::setPixmaps( const std::vector<QPixmap*>& collection )
+
+/*
+  Wait for any background load and create the pixmap.  QPixmap may only
+  be used on the GUI thread so this is deferred until the atlas is used.
+*/
+void PixmapAtlas::finish()
 {
-    _pix = collection;
-    if( ! _pix.empty() )
+    if( _loader )
+    {
+        _loader->wait();
+        delete _loader;
+        _loader = NULL;
+    }
+    if( ! _image.isNull() )
     {
-        QPixmap* pm = _pix[0];
-        _dim.w = pm->width();
-        _dim.h = pm->height();
+        _pix.convertFromImage( _image );
+        _image = QImage();
     }
 }
 
-void PixmapChooser::addPixmap( QPixmap* pm )
+
+QRect PixmapAtlas::source( int i ) const
+{
+    return QRect( (i % _cols) * _dim.width(), (i / _cols) * _dim.height(),
+                  _dim.width(), _dim.height() );
+}
+
+
+void PixmapAtlas::draw( QPainter& p, int x, int y, int i )
+{
+    finish();
+    p.drawPixmap( QPoint( x, y ), _pix, source( i ) );
+}
+
+
+/*
+  Draw a horizontal row of images starting at x, y with their left edges
+  dx pixels apart.
+*/
+void PixmapAtlas::drawRow( QPainter& p, int x, int y, int dx,
+                           const uint8_t* ids, int count )
 {
-    if( _pix.empty() )
+    QPainter::PixmapFragment frag[ 32 ];
+    if( count < 1 )
+        return;
+    finish();
+    qreal cx = x + _dim.width() * 0.5;
+    qreal cy = y + _dim.height() * 0.5;
+    int n;
+
+    while( count > 0 )
     {
-        _dim.w = pm->width();
-        _dim.h = pm->height();
+        n = (count < 32) ? count : 32;
+        for( int i = 0; i < n; ++i, cx += dx )
+            frag[i] = QPainter::PixmapFragment::create( QPointF( cx, cy ),
+                                                        source( ids[i] ) );
+        p.drawPixmapFragments( frag, n, _pix );
+        ids += n;
+        count -= n;
     }
-    _pix.push_back(pm);
+}
+
+
+//----------------------------------------------------------------------------
+
+
+PixmapChooser::PixmapChooser( QWidget* parent )
+    : QWidget(parent), _atlas(NULL), _cols(4), _sel(-1)
+{
+    setSizePolicy( QSizePolicy::Fixed, QSizePolicy::Fixed );
+}
+
+/*
+  Show all the images of an atlas.  The atlas does not need to be ready
+  until the chooser is shown.
+*/
+void PixmapChooser::setAtlas( PixmapAtlas* atlas )
+{
+    _atlas = atlas;
+    _pix.clear();
+    for( int i = 0; i < atlas->count(); ++i )
+        _pix.push_back( i );
+}
+
+/*
+  Append a single image from the atlas.  Must be called after setAtlas().
+*/
+void PixmapChooser::addPixmap( int i )
+{
+    _pix.push_back( i );
 }
 
 QSize PixmapChooser::sizeHint() const
 {
     int count = _pix.size();
     if( count )
-        return QSize( 2 + (_dim.w + pad) * _cols,
-                      2 + (_dim.h + pad) * ((count+_cols-1) / _cols) );
+    {
+        int rows = (count + _cols - 1) / _cols;
+        return QSize( 2 + (_atlas->width() + pad) * _cols,
+                      2 + (_atlas->height() + pad) * rows );
+    }
     return QSize( 16 * _cols, 16 );
 }
 
 int PixmapChooser::indexAt( int px, int py )
 {
+    if( ! _atlas )
+        return -1;
+    int w = _atlas->width() + pad;
     px -= 2;
     py -= 2;
-    if( py < 0 || px < 0 || px >= ((_dim.w + pad) * _cols) )
+    if( py < 0 || px < 0 || px >= (w * _cols) )
         return -1;
-    return py / (_dim.h + pad) * _cols + px / (_dim.w + pad);
+    return py / (_atlas->height() + pad) * _cols + px / w;
 }
 
 void PixmapChooser::mousePressEvent( QMouseEvent* ev )
@@ -68,7 +248,7 @@ void PixmapChooser::mouseReleaseEvent( QMouseEvent* ev )
         ev->button() == Qt::RightButton )
     {
         int ns = indexAt(POS_X(ev), POS_Y(ev));
-        if( ns >= 0 )
+        if( ns >= 0 && ns < int(_pix.size()) )
             emit selected(ns);
     }
 }
@@ -90,28 +270,19 @@ void PixmapChooser::paintEvent( QPaintEvent* ev )
     {
         QPainter p(this);
         int i;
-        int c = 0;
         int x = hpad;
         int y = hpad;
         int rbottom = ev->rect().bottom();
 
-        QSize rdim( _dim.w + pad, _dim.h + pad );
+        QSize rdim( _atlas->width() + pad, _atlas->height() + pad );
 
-        for( i = 0; i < count; ++i )
+        for( i = 0; i < count; i += _cols )
         {
-            p.drawPixmap( x, y, *_pix[i] );
-            if( ++c == _cols )
-            {
-                c = 0;
-                x = hpad;
-                y += rdim.height();
-                if( y > rbottom )
-                    break;
-            }
-            else
-            {
-                x += rdim.width();
-            }
+            if( y > rbottom )
+                break;
+            _atlas->drawRow( p, x, y, rdim.width(), &_pix[i],
+                             std::min( _cols, count - i ) );
+            y += rdim.height();
         }
 
         if( _sel >= 0 )
@@ -121,7 +292,7 @@ void PixmapChooser::paintEvent( QPaintEvent* ev )
             p.setPen( pen );
             p.drawRect( 1 + _sel % _cols * rdim.width(),
                         1 + _sel / _cols * rdim.height(),
-                        _dim.w + pad, _dim.h + pad );
+                        rdim.width(), rdim.height() );
         }
     }
 }
@@ -1,9 +1,52 @@
 #ifndef PIXMAPCHOOSER_H
 #define PIXMAPCHOOSER_H
 
+#include <stdint.h>
 #include <vector>
+#include <QPixmap>
 #include <QWidget>
 
+class QThread;
+
+/*
+  Equally sized pixmaps packed into a single pixmap so that many can be
+  drawn in one batch.  The images can be decoded on a background thread;
+  the first call that needs the pixmap waits for it.
+*/
+class PixmapAtlas
+{
+public:
+    PixmapAtlas() : _loader(NULL), _files(NULL), _count(0), _cols(1),
+                    _loaded(0), _decodeMs(0) {}
+    ~PixmapAtlas();
+    int  load( const char** files, int count, int cols = 8 );
+    void loadAsync( const char** files, int count, int cols = 8 );
+    bool ready() const;
+    int  count() const { return _count; }
+    int  decodeTime() const { return _decodeMs; }
+    int  width() { finish(); return _dim.width(); }
+    int  height() { finish(); return _dim.height(); }
+    void draw( QPainter&, int x, int y, int i );
+    void drawRow( QPainter&, int x, int y, int dx, const uint8_t* ids,
+                  int count );
+
+private:
+    friend class AtlasLoader;
+    void decode();
+    void finish();
+    QRect source( int i ) const;
+
+    QThread* _loader;
+    const char** _files;
+    QImage _image;
+    QPixmap _pix;
+    QSize _dim;
+    int _count;
+    int _cols;
+    int _loaded;
+    int _decodeMs;
+};
+
 class PixmapChooser : public QWidget
 {
     Q_OBJECT
@@ -12,8 +55,9 @@ public:
     PixmapChooser( QWidget* parent = NULL );
     void setColumns( int count ) { _cols = count; }
     void deselect() { _sel = -1; }
-    void setPixmaps( const std::vector<QPixmap*>& );
-    void addPixmap( QPixmap* pm );
+    void clear() { _pix.clear(); }
+    void setAtlas( PixmapAtlas* );
+    void addPixmap( int i );
     QSize sizeHint() const;
 
 signals:
@@ -29,8 +73,8 @@ protected:
 private:
     static const int pad = 4;
     static const int hpad = pad / 2 + 1;
-    std::vector<QPixmap*> _pix;
-    struct { int w, h; } _dim;
+    PixmapAtlas* _atlas;
+    std::vector<uint8_t> _pix;      // Atlas indices.
     int _cols;
     int _sel;
 };
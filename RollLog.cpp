@@ -0,0 +1,211 @@
+/*
+  Action Timeline
+  Copyright 2020 Karl Robillard
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <inttypes.h>
+#include <string.h>
+#include "RollLog.h"
+
+
+RollLog::RollLog() : _lastSpec(0), _seed(0), _fp(NULL)
+{
+}
+
+
+RollLog::~RollLog()
+{
+    close();
+}
+
+
+/*
+  Mirror the log to a file.  New records are appended to any existing
+  file content.
+*/
+bool RollLog::open( const char* file )
+{
+    close();
+    _fp = fopen( file, "a" );
+    if( ! _fp )
+        return false;
+    for( size_t i = 0; i < _rec.size(); ++i )
+    {
+        if( ! i || _rec[i].seed != _rec[i-1].seed )
+            fprintf( _fp, "seed %" PRIu64 "\n", _rec[i].seed );
+        writeRecord( _rec[i] );
+    }
+    if( _rec.empty() || _rec.back().seed != _seed )
+        fprintf( _fp, "seed %" PRIu64 "\n", _seed );
+    fflush( _fp );
+    return true;
+}
+
+
+void RollLog::close()
+{
+    if( _fp )
+    {
+        fclose( _fp );
+        _fp = NULL;
+    }
+}
+
+
+/*
+  Read a line of any length without the line terminator.
+  Return false at the end of the file.
+*/
+static bool _readLine( FILE* fp, std::string& line )
+{
+    char buf[ 512 ];
+    size_t len;
+
+    line.clear();
+    while( fgets( buf, sizeof(buf), fp ) )
+    {
+        line.append( buf );
+        len = line.size();
+        if( line[len-1] == '\n' )
+        {
+            while( len && (line[len-1] == '\n' || line[len-1] == '\r') )
+                --len;
+            line.resize( len );
+            return true;
+        }
+    }
+    return ! line.empty();
+}
+
+
+/*
+  Load the records from a log file written by open().
+  Return false if the file cannot be read or is malformed.
+*/
+bool RollLog::read( const char* file )
+{
+    FILE* fp = fopen( file, "r" );
+    if( ! fp )
+        return false;
+
+    std::string buf;
+    std::vector<int> dice;
+    uint64_t seed = _seed;
+    bool ok = true;
+
+    while( ok && _readLine( fp, buf ) )
+    {
+        const char* line = buf.c_str();
+        const char* cp;
+        char* end;
+        if( buf.empty() )
+            continue;
+
+        if( strncmp( line, "seed ", 5 ) == 0 )
+        {
+            seed = strtoull( line + 5, &end, 10 );
+            if( end == line + 5 )
+                ok = false;
+            continue;
+        }
+
+        uint64_t offset = strtoull( line, &end, 10 );
+        ok = (end != line);
+        cp = end;
+        int total  = (int) strtol( cp, &end, 10 );
+        ok = ok && (end != cp);
+        cp = end;
+        long count = strtol( cp, &end, 10 );
+        ok = ok && (end != cp && count >= 0 && count < 10000);
+        dice.clear();
+        for( long i = 0; ok && i < count; ++i )
+        {
+            cp = end;
+            dice.push_back( (int) strtol( cp, &end, 10 ) );
+            ok = (end != cp);
+        }
+        if( ok )
+        {
+            while( *end == ' ' )
+                ++end;
+            if( seed != _seed )
+                setSeed( seed );
+            append( offset, end, total, dice.data(), count );
+        }
+    }
+
+    // A seed line with no records after it still sets the stream.
+    if( ok && seed != _seed )
+        setSeed( seed );
+
+    fclose( fp );
+    return ok;
+}
+
+
+/*
+  Set the seed of the rng stream for records appended after this call.
+*/
+void RollLog::setSeed( uint64_t seed )
+{
+    _seed = seed;
+    if( _fp )
+    {
+        fprintf( _fp, "seed %" PRIu64 "\n", _seed );
+        fflush( _fp );
+    }
+}
+
+
+void RollLog::append( uint64_t offset, const char* spec, int total,
+                      const int* dice, int diceCount )
+{
+    Record rec;
+    rec.seed   = _seed;
+    rec.offset = offset;
+    rec.total  = total;
+
+    // Consecutive rolls of the same spec share the string.
+    if( _specs.empty() || strcmp( &_specs[ _lastSpec ], spec ) != 0 )
+    {
+        _lastSpec = _specs.size();
+        _specs.insert( _specs.end(), spec, spec + strlen(spec) + 1 );
+    }
+    rec.spec = _lastSpec;
+
+    rec.dice = _dice.size();
+    rec.diceCount = diceCount;
+    _dice.insert( _dice.end(), dice, dice + diceCount );
+
+    _rec.push_back( rec );
+    if( _fp )
+    {
+        writeRecord( rec );
+        fflush( _fp );
+    }
+}
+
+
+void RollLog::writeRecord( const Record& rec )
+{
+    const int* it = dice( rec );
+    fprintf( _fp, "%" PRIu64 " %d %u", rec.offset, rec.total, rec.diceCount );
+    for( uint32_t i = 0; i < rec.diceCount; ++i )
+        fprintf( _fp, " %d", it[i] );
+    fprintf( _fp, " %s\n", spec( rec ) );
+}
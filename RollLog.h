@@ -0,0 +1,73 @@
+#ifndef ROLLLOG_H
+#define ROLLLOG_H
+/*
+  Action Timeline
+  Copyright 2020 Karl Robillard
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+/*
+  Append-only record of dice rolls.  Each roll stores the seed & offset
+  into the rng stream where it began so it can be replayed exactly.
+
+  When a file is opened, records are also written to it as text lines:
+
+    seed <seed>
+    <offset> <total> <dice-count> <die>... <spec>
+*/
+class RollLog
+{
+public:
+    struct Record
+    {
+        uint64_t seed;
+        uint64_t offset;
+        int total;
+        uint32_t spec;      // Index into _specs.
+        uint32_t dice;      // Index into _dice.
+        uint32_t diceCount;
+    };
+
+    RollLog();
+    ~RollLog();
+    bool open( const char* file );
+    void close();
+    bool read( const char* file );
+    void setSeed( uint64_t seed );
+    uint64_t seed() const { return _seed; }
+    void append( uint64_t offset, const char* spec, int total,
+                 const int* dice, int diceCount );
+    size_t size() const { return _rec.size(); }
+    const Record& record( size_t i ) const { return _rec[i]; }
+    const char* spec( const Record& r ) const { return &_specs[ r.spec ]; }
+    const int* dice( const Record& r ) const { return _dice.data() + r.dice; }
+
+private:
+    void writeRecord( const Record& );
+
+    std::vector<Record> _rec;
+    std::vector<int> _dice;
+    std::vector<char> _specs;   // Nul terminated strings.
+    uint32_t _lastSpec;
+    uint64_t _seed;
+    FILE* _fp;
+};
+
+#endif //ROLLLOG_H
@@ -0,0 +1,433 @@
+/*
+  Action Timeline
+  Copyright 2020 Karl Robillard
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+  Session files are little-endian and laid out as flat arrays so they can
+  be memory mapped and copied in bulk.  All sections are 4-byte aligned.
+
+    SessionHeader
+    char     actionStrings[ stringSize ]    (ActionTable::strings())
+    int32_t  actionEntry[ actionCount * 2 ] (ActionTable::entries())
+    SessionSubject subject[ subjectCount ]
+    float    spanStart[ spanCount ]
+    float    spanEnd[ spanCount ]
+    int32_t  spanAction[ spanCount ]
+    uint32_t spanText[ spanCount ]          (Offset into text)
+    uint8_t  spanFlags[ spanCount ]
+    uint16_t tokenDur[ tokenCount ]
+    uint8_t  tokenId[ tokenCount ]
+    char     text[ textSize ]               (Nul terminated strings)
+
+  Offset zero of the text section is always an empty string.  Only the
+  spans which have not ended (from SpanList::head) are saved.
+
+  Version 1 files have no tokenCount in the header & no token sections;
+  instead each subject holds up to six tokens (SessionSubjectV1).
+  Version 2 subjects have no initiative.
+*/
+
+
+#include <string.h>
+#include <QFile>
+#include <QSaveFile>
+#include <QtEndian>
+#include "Session.h"
+#include "Trace.h"
+
+#define SESSION_VERSION 3
+#define ALIGN4(n)       (((n) + 3) & ~size_t(3))
+
+struct SessionHeader
+{
+    char     magic[4];          // "ATLS"
+    uint32_t version;
+    int32_t  startTime;
+    int32_t  turnDuration;
+    uint32_t actionCount;
+    uint32_t stringSize;
+    uint32_t subjectCount;
+    uint32_t spanCount;
+    uint32_t textSize;
+    uint32_t tokenCount;        // Version 2.
+};
+
+#define HEADER_SIZE_V1  36
+
+struct SessionSubject
+{
+    uint32_t name;              // Offset into text.
+    uint32_t spanCount;
+    uint32_t tokenCount;
+    int32_t  initiative;        // Version 3.
+};
+
+#define SUBJECT_SIZE_V2 12
+#define TOKEN_MAX_V1    6
+
+struct SessionSubjectV1
+{
+    uint32_t name;
+    uint32_t spanCount;
+    uint8_t  tokenId[ TOKEN_MAX_V1 ];
+    uint8_t  tokenDur[ TOKEN_MAX_V1 ];   // Unused.
+    uint8_t  tokenCount;
+    uint8_t  pad[3];
+};
+
+
+//----------------------------------------------------------------------------
+// Writing
+
+
+static void _put32( QByteArray& buf, uint32_t n )
+{
+    char le[4];
+    qToLittleEndian<quint32>( n, le );
+    buf.append( le, 4 );
+}
+
+
+static void _putFloat( QByteArray& buf, float f )
+{
+    uint32_t n;
+    memcpy( &n, &f, 4 );
+    _put32( buf, n );
+}
+
+
+static void _pad4( QByteArray& buf )
+{
+    while( buf.size() & 3 )
+        buf.append( '\0' );
+}
+
+
+/*
+  Append a string to the text section and return its offset.
+*/
+static uint32_t _addText( std::vector<char>& text, const std::string& str )
+{
+    if( str.empty() )
+        return 0;
+    uint32_t pos = text.size();
+    text.insert( text.end(), str.c_str(), str.c_str() + str.size() + 1 );
+    return pos;
+}
+
+
+const char* writeSession( const QString& file, const ActionTable& at,
+                          const TimelineModel& model, int turnDuration )
+{
+    TRACE_SCOPE( "writeSession" );
+    const std::vector<char>& strings = at.strings();
+    const std::vector<int>& entry = at.entries();
+    std::vector<char> text( 1, '\0' );
+    int subjects = model.subjectCount();
+    uint32_t spanCount = 0;
+    uint32_t tokenCount = 0;
+    int i, n;
+
+    for( i = 0; i < subjects; ++i )
+    {
+        const SpanList& sl = model.spans( i );
+        spanCount += sl.size() - sl.head;
+        tokenCount += model.tokens( i ).count();
+    }
+
+    QByteArray buf;
+    buf.reserve( sizeof(SessionHeader) + ALIGN4(strings.size()) +
+                 entry.size() * 4 + subjects * sizeof(SessionSubject) +
+                 spanCount * 17 + tokenCount * 3 + 8 );
+
+    buf.append( "ATLS", 4 );
+    _put32( buf, SESSION_VERSION );
+    _put32( buf, model.startTime() );
+    _put32( buf, turnDuration );
+    _put32( buf, at.count() );
+    _put32( buf, strings.size() );
+    _put32( buf, subjects );
+    _put32( buf, spanCount );
+    _put32( buf, 0 );           // textSize is filled in at the end.
+    _put32( buf, tokenCount );
+
+    buf.append( strings.data(), strings.size() );
+    _pad4( buf );
+    for( size_t e = 0; e < entry.size(); ++e )
+        _put32( buf, entry[e] );
+
+    for( i = 0; i < subjects; ++i )
+    {
+        const SpanList& sl = model.spans( i );
+        const TokenSet& ts = model.tokens( i );
+        _put32( buf, _addText( text, model.subjectName( i ) ) );
+        _put32( buf, sl.size() - sl.head );
+        _put32( buf, ts.count() );
+        _put32( buf, model.initiative( i ) );
+    }
+
+    // Span columns.
+    for( i = 0; i < subjects; ++i )
+    {
+        const SpanList& sl = model.spans( i );
+        for( n = sl.head; n < sl.size(); ++n )
+            _putFloat( buf, sl.start[n] );
+    }
+    for( i = 0; i < subjects; ++i )
+    {
+        const SpanList& sl = model.spans( i );
+        for( n = sl.head; n < sl.size(); ++n )
+            _putFloat( buf, sl.end[n] );
+    }
+    for( i = 0; i < subjects; ++i )
+    {
+        const SpanList& sl = model.spans( i );
+        for( n = sl.head; n < sl.size(); ++n )
+            _put32( buf, sl.action[n] );
+    }
+    for( i = 0; i < subjects; ++i )
+    {
+        const SpanList& sl = model.spans( i );
+        for( n = sl.head; n < sl.size(); ++n )
+            _put32( buf, _addText( text, sl.text[n] ) );
+    }
+    for( i = 0; i < subjects; ++i )
+    {
+        const SpanList& sl = model.spans( i );
+        buf.append( (const char*) sl.flags.data() + sl.head,
+                    sl.size() - sl.head );
+    }
+    _pad4( buf );
+
+    // Token columns.
+    for( i = 0; i < subjects; ++i )
+    {
+        const TokenSet& ts = model.tokens( i );
+        const uint16_t* dur = ts.durations();
+        for( n = 0; n < ts.count(); ++n )
+        {
+            char le[2];
+            qToLittleEndian<quint16>( dur[n], le );
+            buf.append( le, 2 );
+        }
+    }
+    _pad4( buf );
+    for( i = 0; i < subjects; ++i )
+    {
+        const TokenSet& ts = model.tokens( i );
+        buf.append( (const char*) ts.ids(), ts.count() );
+    }
+    _pad4( buf );
+
+    buf.append( text.data(), text.size() );
+    qToLittleEndian<quint32>( text.size(), buf.data() + 32 );
+
+    QSaveFile fp( file );
+    if( ! fp.open( QIODevice::WriteOnly ) )
+        return "Cannot open session file for writing";
+    if( fp.write( buf ) != buf.size() || ! fp.commit() )
+        return "Failed to write session file";
+    return NULL;
+}
+
+
+//----------------------------------------------------------------------------
+// Reading
+
+
+/*
+  Return n little-endian 32-bit values at src in host order.  On little-
+  endian hosts the mapped file data is used directly.
+*/
+static const uint32_t* _hostLE32( const uchar* src, size_t n,
+                                  std::vector<uint32_t>& tmp )
+{
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    (void) n;
+    (void) tmp;
+    return reinterpret_cast<const uint32_t*>( src );
+#else
+    tmp.resize( n );
+    for( size_t i = 0; i < n; ++i )
+        tmp[i] = qFromLittleEndian<quint32>( src + i * 4 );
+    return tmp.data();
+#endif
+}
+
+
+const char* readSession( const QString& file, ActionTable& at,
+                         TimelineModel& model, int& turnDuration )
+{
+    static const char* invalid = "Invalid session file";
+    TRACE_SCOPE( "readSession" );
+
+    QFile fp( file );
+    if( ! fp.open( QIODevice::ReadOnly ) )
+        return "Cannot open session file";
+
+    qint64 fileSize = fp.size();
+    if( fileSize < HEADER_SIZE_V1 )
+        return invalid;
+    const uchar* data = fp.map( 0, fileSize );
+    if( ! data )
+        return "Cannot map session file";
+
+    std::vector<uint32_t> tmp;
+    const uint32_t* hdr = _hostLE32( data + 4, 8, tmp );
+    if( memcmp( data, "ATLS", 4 ) != 0 )
+        return invalid;
+    uint32_t version = hdr[0];
+    if( version < 1 || version > SESSION_VERSION )
+        return "Unsupported session file version";
+
+    int32_t  startTime    = int32_t(hdr[1]);
+    int32_t  turn         = int32_t(hdr[2]);
+    uint32_t actionCount  = hdr[3];
+    uint32_t stringSize   = hdr[4];
+    uint32_t subjectCount = hdr[5];
+    uint32_t spanCount    = hdr[6];
+    uint32_t textSize     = hdr[7];
+    uint32_t tokenCount   = 0;
+
+    uint64_t pos = HEADER_SIZE_V1;
+    uint64_t subjectSize = sizeof(SessionSubjectV1);
+    if( version >= 2 )
+    {
+        if( fileSize < qint64(sizeof(SessionHeader)) )
+            return invalid;
+        tokenCount = qFromLittleEndian<quint32>( data + HEADER_SIZE_V1 );
+        pos = sizeof(SessionHeader);
+        subjectSize = (version >= 3) ? sizeof(SessionSubject)
+                                     : SUBJECT_SIZE_V2;
+    }
+
+    // Locate the sections (64-bit math avoids overflow).
+    uint64_t oStrings = pos;    pos += ALIGN4(uint64_t(stringSize));
+    uint64_t oEntry   = pos;    pos += uint64_t(actionCount) * 8;
+    uint64_t oSubject = pos;    pos += uint64_t(subjectCount) * subjectSize;
+    uint64_t oStart   = pos;    pos += uint64_t(spanCount) * 4;
+    uint64_t oEnd     = pos;    pos += uint64_t(spanCount) * 4;
+    uint64_t oAction  = pos;    pos += uint64_t(spanCount) * 4;
+    uint64_t oSpanTxt = pos;    pos += uint64_t(spanCount) * 4;
+    uint64_t oFlags   = pos;    pos += ALIGN4(uint64_t(spanCount));
+    uint64_t oTokDur  = pos;    pos += ALIGN4(uint64_t(tokenCount) * 2);
+    uint64_t oTokId   = pos;    pos += ALIGN4(uint64_t(tokenCount));
+    uint64_t oText    = pos;    pos += textSize;
+    if( pos > uint64_t(fileSize) )
+        return invalid;
+
+    // Validate everything before modifying the table or model.
+    const char* strings = (const char*) data + oStrings;
+    const char* text    = (const char*) data + oText;
+    if( (stringSize && strings[ stringSize - 1 ] != '\0') ||
+        ! textSize || text[0] != '\0' || text[ textSize - 1 ] != '\0' )
+        return invalid;
+
+    std::vector<uint32_t> tmpEntry, tmpStart, tmpEnd, tmpAction, tmpSpanTxt;
+    const uint32_t* entry = _hostLE32( data + oEntry, actionCount * 2,
+                                       tmpEntry );
+    for( uint32_t i = 0; i < actionCount; ++i )
+    {
+        if( entry[ i*2 ] >= stringSize )
+            return invalid;
+    }
+
+    const uint32_t* action  = _hostLE32( data + oAction, spanCount,
+                                         tmpAction );
+    const uint32_t* spanTxt = _hostLE32( data + oSpanTxt, spanCount,
+                                         tmpSpanTxt );
+    const float* start = (const float*)
+                    _hostLE32( data + oStart, spanCount, tmpStart );
+    const float* end   = (const float*)
+                    _hostLE32( data + oEnd, spanCount, tmpEnd );
+    for( uint32_t n = 0; n < spanCount; ++n )
+    {
+        if( action[n] >= actionCount || spanTxt[n] >= textSize ||
+            ! (start[n] <= end[n]) )
+            return invalid;
+    }
+
+    // All subject versions begin with the name & spanCount.
+    const uchar* subj = data + oSubject;
+    const uchar* sp;
+    uint64_t total = 0;
+    uint64_t totalTok = 0;
+    for( uint32_t i = 0; i < subjectCount; ++i )
+    {
+        sp = subj + i * subjectSize;
+        uint32_t name  = qFromLittleEndian<quint32>( sp );
+        uint32_t count = qFromLittleEndian<quint32>( sp + 4 );
+        if( name >= textSize )
+            return invalid;
+        if( version >= 2 )
+            totalTok += qFromLittleEndian<quint32>( sp + 8 );
+        else if( ((const SessionSubjectV1*) sp)->tokenCount > TOKEN_MAX_V1 )
+            return invalid;
+        total += count;
+    }
+    if( total != spanCount || totalTok != tokenCount )
+        return invalid;
+
+    // Load.
+    at.assign( strings, stringSize, (const int*) entry, actionCount );
+    model.clear( startTime );
+    turnDuration = turn;
+
+    uint32_t first = 0;
+    uint32_t firstTok = 0;
+    for( uint32_t i = 0; i < subjectCount; ++i )
+    {
+        sp = subj + i * subjectSize;
+        uint32_t name  = qFromLittleEndian<quint32>( sp );
+        uint32_t count = qFromLittleEndian<quint32>( sp + 4 );
+        TokenSet ts;
+
+        model.addSubject( text + name );
+        if( version >= 2 )
+        {
+            uint32_t tc = qFromLittleEndian<quint32>( sp + 8 );
+            const uchar* dur = data + oTokDur + firstTok * 2;
+            const uchar* id  = data + oTokId + firstTok;
+            for( uint32_t t = 0; t < tc; ++t )
+                ts.append( id[t], qFromLittleEndian<quint16>( dur + t*2 ) );
+            firstTok += tc;
+        }
+        else
+        {
+            // Version 1 token durations were never used.
+            const SessionSubjectV1* sv = (const SessionSubjectV1*) sp;
+            for( int t = 0; t < sv->tokenCount; ++t )
+                ts.append( sv->tokenId[t], TOKEN_FOREVER );
+        }
+        model.setTokens( i, ts );
+        if( version >= 3 )
+            model.setInitiative( i,
+                        int32_t(qFromLittleEndian<quint32>( sp + 12 )) );
+
+        model.assignSpans( i, count,
+                start + first, end + first,
+                (const int*) (action + first), data + oFlags + first );
+        for( uint32_t n = 0; n < count; ++n )
+        {
+            if( spanTxt[ first + n ] )
+                model.setLabel( i, n, text + spanTxt[ first + n ],
+                                data[ oFlags + first + n ] );
+        }
+        first += count;
+    }
+    return NULL;
+}
@@ -0,0 +1,33 @@
+#ifndef SESSION_H
+#define SESSION_H
+/*
+  Action Timeline
+  Copyright 2020 Karl Robillard
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <QString>
+#include "TimelineModel.h"
+
+/*
+  Encounter state saved & loaded as a binary session file.
+  These return NULL on success or an error message.
+*/
+const char* writeSession( const QString& file, const ActionTable&,
+                          const TimelineModel&, int turnDuration );
+const char* readSession( const QString& file, ActionTable&,
+                         TimelineModel&, int& turnDuration );
+
+#endif //SESSION_H
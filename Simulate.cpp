@@ -0,0 +1,469 @@
+/*
+  Action Timeline
+  Copyright 2020 Karl Robillard
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+/*
+  action-sim: Runs encounters without a GUI (or Qt) for balancing & tests.
+
+  Subjects & actions are given as with action-tl, and a script of turns is
+  run for each encounter.  When an action ends its dice are rolled and the
+  totals are summed per subject.
+*/
+
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "TimelineModel.h"
+#include "evalDice.c"
+
+#define DICE_SEQ    0x41544c     // Same stream selector as action-tl.
+
+enum CommandType
+{
+    CMD_QUEUE,
+    CMD_ADVANCE,
+    CMD_PRINT
+};
+
+struct Command
+{
+    int type;
+    int subject;                // Subject index or -1 for all.
+    int count;                  // Turns to advance.
+    std::vector<int> actions;
+};
+
+struct SubjectStats
+{
+    uint64_t actions;           // Actions completed.
+    uint64_t rolls;
+    int64_t  total;             // Sum of all roll totals.
+};
+
+struct Simulation
+{
+    ActionTable at;
+    TimelineModel model;
+    DiceRng rng;
+    std::vector<std::string> subjects;
+    std::vector< std::vector<DiceOp> > dice;    // Program per action id.
+    std::vector<DiceOp> defaultDice;
+    std::vector<Command> script;
+    std::vector<SubjectStats> stats;
+    int turnDur;
+    int runs;
+    bool verbose;
+};
+
+
+static void usage()
+{
+    printf( "Usage: action-sim [<options>] [<subject> | <action>:<seconds>"
+            "[:<dice>]] ...\n\n"
+            "Options:\n"
+            "  -dice <spec>    Dice rolled for actions without their own.\n"
+            "  -f <file>       Read commands from a script file.\n"
+            "  -n <runs>       Number of encounters to run (default 1).\n"
+            "  -seed <n>       Seed the dice stream.\n"
+            "  -turn <sec>     Turn duration (default 6).\n"
+            "  -v              Print the timeline after every command.\n\n"
+            "Script commands (one per line):\n"
+            "  queue <subject>, <action>[, <action>...]\n"
+            "  advance [<turns>]\n"
+            "  print\n" );
+}
+
+
+/*
+  Compile spec into prog.  Return false if it is invalid.
+*/
+static bool compileProgram( const char* spec, std::vector<DiceOp>& prog )
+{
+    DiceOp ops[ DICE_OP_MAX ];
+    int len = compileDice( spec, ops );
+    if( len < 0 )
+    {
+        fprintf( stderr, "Invalid dice specification %s\n", spec );
+        return false;
+    }
+    prog.assign( ops, ops + len );
+    return true;
+}
+
+
+/*
+  Define or change an action from a "name:seconds[:dice]" argument.
+*/
+static bool defineAction( Simulation& sim, const char* arg, const char* cp )
+{
+    int dur = atoi(cp+1);
+    if( dur < 1 )
+        dur = 1;
+    else if( dur > 10 )
+        dur = 10;
+
+    int id = sim.at.actionId( arg, cp );
+    if( id < 0 )
+        id = sim.at.defineAction( arg, cp, dur );
+    else
+        sim.at.setDuration( id, dur );
+
+    if( (size_t) id >= sim.dice.size() )
+        sim.dice.resize( id + 1 );
+
+    const char* spec = strchr( cp+1, ':' );
+    if( spec )
+        return compileProgram( spec + 1, sim.dice[ id ] );
+    return true;
+}
+
+
+static char* _trim( char* it )
+{
+    while( *it == ' ' || *it == '\t' )
+        ++it;
+    char* end = it + strlen(it);
+    while( end != it && (end[-1] == ' ' || end[-1] == '\t' ||
+                         end[-1] == '\n' || end[-1] == '\r') )
+        --end;
+    *end = '\0';
+    return it;
+}
+
+
+static int subjectIndex( const Simulation& sim, const char* name )
+{
+    if( strcmp( name, "*" ) == 0 )
+        return -1;
+    for( size_t i = 0; i < sim.subjects.size(); ++i )
+    {
+        if( sim.subjects[i] == name )
+            return int(i);
+    }
+    return -2;
+}
+
+
+/*
+  Parse a script line into a command.  Return false and print an error if
+  the line is invalid.  Blank lines & comments set cmd.type to -1.
+*/
+static bool parseCommand( Simulation& sim, char* line, Command& cmd,
+                          const char* file, int lineNum )
+{
+    char* it = _trim( line );
+    char* arg;
+    int len;
+
+    cmd.type = -1;
+    cmd.subject = -1;
+    cmd.count = 1;
+    cmd.actions.clear();
+
+    if( *it == '\0' || *it == '#' )
+        return true;
+
+    len = strcspn( it, " \t" );
+    arg = _trim( it + len );
+    it[len] = '\0';
+
+    if( strcmp( it, "queue" ) == 0 )
+    {
+        char* item = strtok( arg, "," );
+        if( item )
+        {
+            item = _trim( item );
+            cmd.subject = subjectIndex( sim, item );
+            if( cmd.subject < -1 )
+            {
+                fprintf( stderr, "%s:%d: Unknown subject %s\n",
+                         file, lineNum, item );
+                return false;
+            }
+            while( (item = strtok( NULL, "," )) )
+            {
+                item = _trim( item );
+                int id = sim.at.actionId( item );
+                if( id < 0 )
+                {
+                    fprintf( stderr, "%s:%d: Unknown action %s\n",
+                             file, lineNum, item );
+                    return false;
+                }
+                cmd.actions.push_back( id );
+            }
+        }
+        if( cmd.actions.empty() )
+        {
+            fprintf( stderr, "%s:%d: queue needs a subject & actions\n",
+                     file, lineNum );
+            return false;
+        }
+        cmd.type = CMD_QUEUE;
+    }
+    else if( strcmp( it, "advance" ) == 0 )
+    {
+        cmd.type = CMD_ADVANCE;
+        if( *arg )
+            cmd.count = atoi( arg );
+    }
+    else if( strcmp( it, "print" ) == 0 )
+    {
+        cmd.type = CMD_PRINT;
+    }
+    else
+    {
+        fprintf( stderr, "%s:%d: Invalid command %s\n", file, lineNum, it );
+        return false;
+    }
+    return true;
+}
+
+
+static bool readScript( Simulation& sim, const char* file )
+{
+    FILE* fp = fopen( file, "r" );
+    if( ! fp )
+    {
+        fprintf( stderr, "Cannot open script %s\n", file );
+        return false;
+    }
+
+    char line[ 1024 ];
+    Command cmd;
+    int lineNum = 0;
+    bool ok = true;
+    while( ok && fgets( line, sizeof(line), fp ) )
+    {
+        ok = parseCommand( sim, line, cmd, file, ++lineNum );
+        if( ok && cmd.type >= 0 )
+            sim.script.push_back( cmd );
+    }
+    fclose( fp );
+    return ok;
+}
+
+
+static void printTimeline( const Simulation& sim )
+{
+    const TimelineModel& model = sim.model;
+    printf( "time %d\n", model.startTime() );
+    for( int i = 0; i < model.subjectCount(); ++i )
+    {
+        const SpanList& sl = model.spans( i );
+        printf( "  %s:", model.subjectName( i ).c_str() );
+        for( int n = sl.head; n < sl.size(); ++n )
+            printf( " %s (%g-%g)", sim.at.name( sl.action[n] ),
+                    sl.start[n], sl.end[n] );
+        printf( "\n" );
+    }
+}
+
+
+/*
+  Roll the dice for the actions which end during the next sec seconds.
+*/
+static void resolveEnding( Simulation& sim, int sec )
+{
+    TimelineModel& model = sim.model;
+    float t = float(model.startTime() + sec);
+
+    for( int i = 0; i < model.subjectCount(); ++i )
+    {
+        const SpanList& sl = model.spans( i );
+        SubjectStats& st = sim.stats[i];
+        for( int n = sl.head; n < sl.size() && sl.end[n] <= t; ++n )
+        {
+            const std::vector<DiceOp>* prog = &sim.defaultDice;
+            int id = sl.action[n];
+            if( (size_t) id < sim.dice.size() && ! sim.dice[id].empty() )
+                prog = &sim.dice[id];
+
+            ++st.actions;
+            if( ! prog->empty() )
+            {
+                st.total += evalDiceProgram( &sim.rng, prog->data(),
+                                             prog->size(), NULL, NULL );
+                ++st.rolls;
+            }
+        }
+    }
+}
+
+
+static void runEncounter( Simulation& sim )
+{
+    TimelineModel& model = sim.model;
+    std::vector<Command>::const_iterator it;
+    int i, n;
+
+    model.clear();
+    for( i = 0; i < int(sim.subjects.size()); ++i )
+        model.addSubject( sim.subjects[i] );
+
+    for( it = sim.script.begin(); it != sim.script.end(); ++it )
+    {
+        switch( it->type )
+        {
+            case CMD_QUEUE:
+                for( i = 0; i < model.subjectCount(); ++i )
+                {
+                    if( it->subject >= 0 && it->subject != i )
+                        continue;
+                    for( n = 0; n < int(it->actions.size()); ++n )
+                    {
+                        int id = it->actions[n];
+                        model.appendAction( i, id,
+                                            float(sim.at.duration( id )) );
+                    }
+                }
+                break;
+
+            case CMD_ADVANCE:
+                for( n = 0; n < it->count; ++n )
+                {
+                    resolveEnding( sim, sim.turnDur );
+                    model.advance( sim.turnDur );
+                }
+                break;
+
+            case CMD_PRINT:
+                printTimeline( sim );
+                break;
+        }
+        if( sim.verbose && it->type != CMD_PRINT )
+            printTimeline( sim );
+    }
+}
+
+
+static void printStats( const Simulation& sim, double elapsed )
+{
+    double runs = sim.runs;
+    printf( "runs %d  seconds %.3f  (%.0f runs/sec)\n", sim.runs, elapsed,
+            (elapsed > 0.0) ? runs / elapsed : 0.0 );
+    printf( "%-20s %10s %10s %12s %12s\n",
+            "subject", "actions", "rolls", "mean roll", "total/run" );
+    for( size_t i = 0; i < sim.subjects.size(); ++i )
+    {
+        const SubjectStats& st = sim.stats[i];
+        printf( "%-20s %10.2f %10.2f %12.2f %12.2f\n",
+                sim.subjects[i].c_str(), st.actions / runs, st.rolls / runs,
+                st.rolls ? double(st.total) / st.rolls : 0.0,
+                st.total / runs );
+    }
+}
+
+
+int main( int argc, char** argv )
+{
+    Simulation sim;
+    const char* scriptFile = NULL;
+    uint64_t seed = uint64_t(time(NULL));
+    char* cp;
+    int i;
+
+    sim.turnDur = 6;
+    sim.runs = 1;
+    sim.verbose = false;
+    sim.at.defineBuiltins();
+
+    for( i = 1; i < argc; ++i )
+    {
+        const char* opt = argv[i];
+        const char* val = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if( opt[0] == '-' && opt[1] )
+        {
+            if( strcmp( opt, "-h" ) == 0 || strcmp( opt, "-help" ) == 0 )
+            {
+                usage();
+                return 0;
+            }
+            else if( strcmp( opt, "-v" ) == 0 )
+            {
+                sim.verbose = true;
+                continue;
+            }
+            else if( ! val )
+            {
+                fprintf( stderr, "Option %s needs a value\n", opt );
+                return 1;
+            }
+            else if( strcmp( opt, "-dice" ) == 0 )
+            {
+                if( ! compileProgram( val, sim.defaultDice ) )
+                    return 1;
+            }
+            else if( strcmp( opt, "-f" ) == 0 )
+                scriptFile = val;
+            else if( strcmp( opt, "-n" ) == 0 )
+                sim.runs = atoi( val );
+            else if( strcmp( opt, "-seed" ) == 0 )
+                seed = strtoull( val, NULL, 0 );
+            else if( strcmp( opt, "-turn" ) == 0 )
+                sim.turnDur = atoi( val );
+            else
+            {
+                fprintf( stderr, "Invalid option %s\n", opt );
+                return 1;
+            }
+            ++i;
+        }
+        else if( (cp = strchr(argv[i], ':')) )
+        {
+            if( ! defineAction( sim, argv[i], cp ) )
+                return 1;
+        }
+        else
+        {
+            sim.subjects.push_back( argv[i] );
+        }
+    }
+
+    if( sim.runs < 1 || sim.turnDur < 1 )
+    {
+        fprintf( stderr, "Runs & turn duration must be positive\n" );
+        return 1;
+    }
+
+    if( scriptFile )
+    {
+        if( ! readScript( sim, scriptFile ) )
+            return 1;
+    }
+    else
+    {
+        Command cmd;
+        cmd.type = CMD_ADVANCE;
+        cmd.subject = -1;
+        cmd.count = 1;
+        sim.script.push_back( cmd );
+    }
+
+    SubjectStats zero = { 0, 0, 0 };
+    sim.stats.assign( sim.subjects.size(), zero );
+    diceSeed( &sim.rng, seed, DICE_SEQ );
+
+    clock_t start = clock();
+    for( i = 0; i < sim.runs; ++i )
+        runEncounter( sim );
+    printStats( sim, double(clock() - start) / CLOCKS_PER_SEC );
+    return 0;
+}
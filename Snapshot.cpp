@@ -0,0 +1,287 @@
+/*
+  Action Timeline
+  Copyright 2020 Karl Robillard
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <string.h>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include "Snapshot.h"
+#include "Trace.h"
+
+#define QUEUE_LIMIT 4
+
+
+//----------------------------------------------------------------------------
+// QOI encoder (see https://qoiformat.org/qoi-specification.pdf)
+
+
+#define QOI_OP_INDEX    0x00
+#define QOI_OP_DIFF     0x40
+#define QOI_OP_LUMA     0x80
+#define QOI_OP_RUN      0xc0
+#define QOI_OP_RGB      0xfe
+
+static void _putBE32( QByteArray& buf, uint32_t n )
+{
+    buf.append( char(n >> 24) );
+    buf.append( char(n >> 16) );
+    buf.append( char(n >> 8) );
+    buf.append( char(n) );
+}
+
+
+/*
+  Encode an opaque image as a 3 channel QOI file.
+*/
+static QByteArray _encodeQOI( const QImage& src )
+{
+    QImage img = src.convertToFormat( QImage::Format_RGB32 );
+    QByteArray buf;
+    QRgb index[64];
+    QRgb prev = qRgb(0, 0, 0);
+    const QRgb* it;
+    const QRgb* end;
+    QRgb px;
+    int run = 0;
+    int w = img.width();
+    int h = img.height();
+
+    memset( index, 0, sizeof(index) );
+    buf.reserve( 14 + w * h + 8 );
+    buf.append( "qoif", 4 );
+    _putBE32( buf, w );
+    _putBE32( buf, h );
+    buf.append( char(3) );      // RGB
+    buf.append( char(0) );      // sRGB with linear alpha
+
+    for( int y = 0; y < h; ++y )
+    {
+        it  = reinterpret_cast<const QRgb*>( img.constScanLine(y) );
+        end = it + w;
+        for( ; it != end; ++it )
+        {
+            px = *it | 0xff000000;
+            if( px == prev )
+            {
+                if( ++run == 62 )
+                {
+                    buf.append( char(QOI_OP_RUN | (run - 1)) );
+                    run = 0;
+                }
+                continue;
+            }
+
+            if( run )
+            {
+                buf.append( char(QOI_OP_RUN | (run - 1)) );
+                run = 0;
+            }
+
+            int r = qRed(px);
+            int g = qGreen(px);
+            int b = qBlue(px);
+            int hash = (r * 3 + g * 5 + b * 7 + 255 * 11) & 63;
+
+            if( index[hash] == px )
+            {
+                buf.append( char(QOI_OP_INDEX | hash) );
+            }
+            else
+            {
+                index[hash] = px;
+
+                signed char vr = r - qRed(prev);
+                signed char vg = g - qGreen(prev);
+                signed char vb = b - qBlue(prev);
+                signed char vgr = vr - vg;
+                signed char vgb = vb - vg;
+
+                if( vr > -3 && vr < 2 && vg > -3 && vg < 2 &&
+                    vb > -3 && vb < 2 )
+                {
+                    buf.append( char(QOI_OP_DIFF | (vr + 2) << 4 |
+                                     (vg + 2) << 2 | (vb + 2)) );
+                }
+                else if( vgr > -9 && vgr < 8 && vg > -33 && vg < 32 &&
+                         vgb > -9 && vgb < 8 )
+                {
+                    buf.append( char(QOI_OP_LUMA | (vg + 32)) );
+                    buf.append( char((vgr + 8) << 4 | (vgb + 8)) );
+                }
+                else
+                {
+                    buf.append( char(QOI_OP_RGB) );
+                    buf.append( char(r) );
+                    buf.append( char(g) );
+                    buf.append( char(b) );
+                }
+            }
+            prev = px;
+        }
+    }
+    if( run )
+        buf.append( char(QOI_OP_RUN | (run - 1)) );
+
+    buf.append( "\0\0\0\0\0\0\0\1", 8 );
+    return buf;
+}
+
+
+//----------------------------------------------------------------------------
+
+
+SnapshotWriter::SnapshotWriter( QObject* parent )
+    : QThread(parent), _quit(false)
+{
+    _dir = QDir::tempPath();
+#ifdef _WIN32
+    _format = FORMAT_OFF;
+#else
+    _format = FORMAT_JPEG;
+#endif
+}
+
+
+SnapshotWriter::~SnapshotWriter()
+{
+    finish();
+}
+
+
+/*
+  Set format from a name ("jpeg", "png", "qoi" or "off").
+  Return false if the name is not recognized.
+*/
+bool SnapshotWriter::setFormat( const char* name )
+{
+    static const char* names[] = { "off", "jpeg", "png", "qoi" };
+    for( int i = 0; i < 4; ++i )
+    {
+        if( strcmp( name, names[i] ) == 0 )
+        {
+            _format = Format(i);
+            return true;
+        }
+    }
+    if( strcmp( name, "jpg" ) == 0 )
+    {
+        _format = FORMAT_JPEG;
+        return true;
+    }
+    return false;
+}
+
+
+/*
+  Add an image to the write queue.  Return false if the snapshot was
+  dropped because the queue is full or snapshots are disabled.
+*/
+bool SnapshotWriter::queue( const QImage& img, int sec )
+{
+    static const char* ext[] = { "", "jpeg", "png", "qoi" };
+
+    if( _format == FORMAT_OFF )
+        return false;
+
+    Job job;
+    job.img = img;
+    job.format = _format;
+    job.file = QDir( _dir ).filePath( QString( "action-%1-%2sec.%3" )
+                    .arg( QCoreApplication::applicationPid() )
+                    .arg( sec ).arg( ext[_format] ) );
+
+    _mutex.lock();
+    bool full = (_jobs.size() >= QUEUE_LIMIT);
+    if( ! full )
+    {
+        _jobs.push_back( job );
+        _cond.wakeOne();
+    }
+    _mutex.unlock();
+
+    if( full )
+    {
+        fprintf( stderr, "Snapshot queue full; dropped %s\n",
+                 job.file.toLocal8Bit().constData() );
+        return false;
+    }
+
+    if( ! isRunning() )
+        start();
+    return true;
+}
+
+
+/*
+  Write any pending images and stop the thread.
+*/
+void SnapshotWriter::finish()
+{
+    if( isRunning() )
+    {
+        _mutex.lock();
+        _quit = true;
+        _cond.wakeOne();
+        _mutex.unlock();
+        wait();
+        _quit = false;
+    }
+}
+
+
+void SnapshotWriter::run()
+{
+    Job job;
+    bool ok;
+
+    for(;;)
+    {
+        _mutex.lock();
+        while( _jobs.empty() && ! _quit )
+            _cond.wait( &_mutex );
+        if( _jobs.empty() )
+        {
+            _mutex.unlock();
+            break;
+        }
+        job = _jobs.front();
+        _jobs.pop_front();
+        _mutex.unlock();
+
+        TRACE_SCOPE_ARG( "SnapshotWriter::write", job.format );
+        if( job.format == FORMAT_QOI )
+        {
+            QByteArray data = _encodeQOI( job.img );
+            QFile file( job.file );
+            ok = file.open( QIODevice::WriteOnly ) &&
+                 file.write( data ) == data.size();
+        }
+        else
+        {
+            ok = job.img.save( job.file,
+                               (job.format == FORMAT_PNG) ? "PNG" : "JPEG" );
+        }
+
+        if( ! ok )
+            fprintf( stderr, "Snapshot write failed: %s\n",
+                     job.file.toLocal8Bit().constData() );
+        job.img = QImage();
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+/*
+  Action Timeline
+  Copyright 2020 Karl Robillard
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <deque>
+#include <QImage>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+
+/*
+  Encodes & writes timeline images on a background thread.
+*/
+class SnapshotWriter : public QThread
+{
+public:
+    enum Format
+    {
+        FORMAT_OFF,
+        FORMAT_JPEG,
+        FORMAT_PNG,
+        FORMAT_QOI
+    };
+
+    SnapshotWriter( QObject* parent = NULL );
+    ~SnapshotWriter();
+    Format format() const { return _format; }
+    bool setFormat( const char* name );
+    void setDirectory( const QString& dir ) { _dir = dir; }
+    bool enabled() const { return _format != FORMAT_OFF; }
+    bool queue( const QImage& img, int sec );
+    void finish();
+
+protected:
+    void run();
+
+private:
+    struct Job
+    {
+        QImage img;
+        QString file;
+        Format format;
+    };
+
+    QMutex _mutex;
+    QWaitCondition _cond;
+    std::deque<Job> _jobs;
+    QString _dir;
+    Format _format;
+    bool _quit;
+};
+
+#endif //SNAPSHOT_H
@@ -17,164 +17,41 @@
 */
 
 
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <algorithm>
 #include <QApplication>
 #include <QBoxLayout>
 #include <QComboBox>
 #include <QPushButton>
 #include <QDropEvent>
+#include <QElapsedTimer>
 #include <QDoubleSpinBox>
+#include <QFileDialog>
 #include <QGridLayout>
 #include <QInputDialog>
 #include <QLabel>
-#include <QListWidget>
+#include <QListView>
 #include <QMenu>
 #include <QMessageBox>
 #include <QMimeData>
 #include <QPainter>
-#include <QStandardItemModel>
+#include <QScrollArea>
+#include <QTimer>
 #include <QWidgetAction>
+#include "ActionList.h"
 #include "PixmapChooser.h"
+#include "RollLog.h"
+#include "Session.h"
 #include "Timeline.h"
+#include "Trace.h"
 
 #define CSTR(qs)    qs.toLocal8Bit().constData()
 #define RGB_RESOLVE qRgb(238, 232, 205)
 #define RGB_SELECT  qRgb(135, 206, 235)
 
-enum ColorLabelType
-{
-    CTYPE_NAME,
-    CTYPE_ACTION
-};
-
-
-//----------------------------------------------------------------------------
-
-
-int ActionTable::defineAction( const char* aname, const char* end, int dur )
-{
-    int id = _entry.size() >> 1;
-
-    _entry.push_back( _strings.size() );
-    _entry.push_back( dur );
-
-    _strings.insert( _strings.end(), aname, end );
-    _strings.push_back( '\0' );
-
-    return id;
-}
-
-
-int ActionTable::actionId( const char* str ) const
-{
-    int count = _entry.size();
-    for( int i = 0; i < count; i += 2 )
-    {
-        if( strcmp( _strings.data() + _entry[i], str ) == 0 )
-            return i >> 1;
-    }
-    return -1;
-}
-
-
-//----------------------------------------------------------------------------
-
-
-// QLabel with direct color control.
-class ColorLabel : public QLabel
-{
-public:
-    ColorLabel( const QString& text, QWidget* parent = NULL )
-        : QLabel(text, parent), fill(false), tokenCount(0) {}
-
-    void setColor( const QColor& col )
-    {
-        QPalette mpal( palette() );
-        mpal.setColor( QPalette::Text, col );
-        setPalette( mpal );
-    }
-
-    void setBase( const QColor& col )
-    {
-        QPalette mpal( palette() );
-        mpal.setColor( QPalette::Base, col );
-        setPalette( mpal );
-        fill = true;
-    }
-
-    void clearBase() {
-        fill = false;
-    }
-
-    void addToken( int n )
-    {
-        if( tokenCount < 6 )
-        {
-            token[ tokenCount ] = n;
-            tokenDur[ tokenCount ] = 255;
-            ++tokenCount;
-            update();
-        }
-    }
-
-    void removeToken( int index )
-    {
-        --tokenCount;
-        for( int i = index; i < tokenCount; ++i )
-        {
-            token[i] = token[i+1];
-            tokenDur[i] = tokenDur[i+1];
-        }
-        update();
-    }
-
-    short ctype;
-    bool  fill;
-    uint8_t token[6];
-    uint8_t tokenDur[6];
-    uint8_t tokenCount;
-
-    static std::vector<QPixmap*> tokenPixmap;
-
-protected:
-    void paintEvent(QPaintEvent*)
-    {
-        QPainter p(this);
-        QFontMetrics fm( fontMetrics() );
-        QColor pcol = palette().color( QPalette::Text );
-        QBrush br;
-        int h = height();
-
-        if( fill )
-        {
-            br.setStyle( Qt::SolidPattern );
-            br.setColor( palette().color( QPalette::Base ) );
-        }
-
-        p.setPen( pcol );
-        p.setBrush( br );
-        p.drawRect( 0, 0, width()-1, h-1 );
-#ifdef CL_CENTER
-        int pad = (h - fm.height()) / 2;
-        p.drawText( 4, h - fm.descent() - pad, text() );
-#else
-        p.drawText( 4, fm.ascent() + 3, text() );
-#endif
-
-        int tokX = width() - tokenCount*18;
-        int tokY = h - 18;
-        for( int i = 0; i < tokenCount; ++i, tokX += 18 )
-        {
-            p.drawPixmap( tokX, tokY, *tokenPixmap[ token[i] ] );
-        }
-    }
-};
-
-
-std::vector<QPixmap*> ColorLabel::tokenPixmap;
-
-
 //----------------------------------------------------------------------------
 
 
@@ -204,50 +81,49 @@ private:
 
 #define SUBJECT_NONE    -1
 #define SUBJECT_WIDTH   132
+#define TOP_MARGIN      15
+#define TOKEN_SIZE      18
+#define TOKEN_ROW       (SUBJECT_WIDTH / TOKEN_SIZE)
+#define PIX_PER_SEC     70
+#define ZOOM_STEPS      4       // Zoom levels per doubling of the scale.
+#define ZOOM_MIN        (-3 * ZOOM_STEPS)
+#define ZOOM_MAX        (2 * ZOOM_STEPS)
+#define SCALE_CACHE     8       // Number of time scale tiles kept.
 
+#define UTF8(qs)        qs.toUtf8().constData()
+#define QSTR(str)       QString::fromUtf8(str.c_str())
 
-static int _subjectHeight( const ColorLabel* cl )
-{
-    int fh = cl->fontMetrics().height();
-    if( cl->tokenCount )
-        fh *= 2;
-    return fh + 6;
-}
 
+PixmapAtlas Timeline::tokenAtlas;
 
-Timeline::Timeline( const ActionTable* at, QWidget* parent )
-    : QWidget(parent), _actions(at)
-{
-    int leftMargin = 0;
 
-    _pixPerSec = 70;
-    _startTime = 0;
+Timeline::Timeline( const ActionTable* at, TimelineModel* model,
+                    QWidget* parent )
+    : QWidget(parent), _actions(at), _model(model)
+{
+    _pixPerSec = PIX_PER_SEC;
+    _zoom = 0;
+    _wheelZoom = 0;
     _turnDur = 6;
     _subject = SUBJECT_NONE;
+    _dragAction = -1;
+    _frameLabel = NULL;
+    _autoOrder = false;
 
     setAcceptDrops(true);
     setSizePolicy( QSizePolicy::Expanding, QSizePolicy::Minimum );
-    _lo = new QVBoxLayout(this);
-    _lo->setSpacing(0);
-    _lo->setContentsMargins( leftMargin, 11, 0, 0 );
-
+    setAttribute( Qt::WA_OpaquePaintEvent );
 
     QAction* act = new QAction( this );
     act->setShortcut( QKeySequence::Delete );
     connect( act, SIGNAL(triggered(bool)), this, SLOT(deleteLastAction()) );
     addAction( act );
 
-    makeTimeScale( _pixPerSec );
-    _scale = new QLabel( this );
-    _scale->setFrameShape( QFrame::NoFrame );    // Does nothing?
-    _scale->setAlignment( Qt::AlignTop );
-    _scale->move( leftMargin + SUBJECT_WIDTH, 0 );
-    _scale->setFixedWidth( _pixPerSec * _turnDur );
-    _scale->setPixmap( _timeScale );
+    layoutRows();
 
     _tokenMenu = new TokenMenu("Add Token", this);
     PixmapChooser* pmc = _tokenMenu->chooser();
-    pmc->setPixmaps( ColorLabel::tokenPixmap );
+    pmc->setAtlas( &tokenAtlas );
     connect( pmc, SIGNAL(selected(int)), SLOT(recordToken(int)) );
 }
 
@@ -281,17 +157,145 @@ void Timeline::recordTokenRem( int n )
 }
 
 
-void Timeline::makeTimeScale( int pixPerSec )
+/*
+  Return the font used for the time scale labels.
+*/
+QFont Timeline::scaleFont() const
+{
+    QFont sf( font() );
+    sf.setPixelSize( TOP_MARGIN - 4 );
+    return sf;
+}
+
+
+/*
+  Return the time scale for one turn at the current zoom level.  Seconds
+  alternate between white & black and are numbered when there is room.
+  The tiles of recently used zoom levels are kept so that zooming and
+  painting the scale is only a blit.
+*/
+const QPixmap& Timeline::timeScaleTile()
 {
-    QImage img( pixPerSec * 10, 10, QImage::Format_RGB888 );
+    size_t i;
+    for( i = 0; i < _scaleTiles.size(); ++i )
+    {
+        const ScaleTile& st = _scaleTiles[i];
+        if( st.zoom == _zoom && st.turnDur == _turnDur )
+            return st.pix;
+    }
+
+    TRACE_SCOPE_ARG( "Timeline::timeScaleTile", _zoom );
+    if( _scaleTiles.size() >= SCALE_CACHE )
+        _scaleTiles.erase( _scaleTiles.begin() );
+
+    QImage img( int(_pixPerSec * _turnDur), TOP_MARGIN - 1,
+                QImage::Format_RGB888 );
     img.fill( Qt::black );
 
     QPainter p( &img );
-    p.setBrush( Qt::white );
-    int x = 0;
-    for( int i = 0; i < 5; ++i, x += pixPerSec * 2 )
-        p.drawRect( x, 0, pixPerSec-1, img.height() );
-    _timeScale.convertFromImage( img );
+    p.setFont( scaleFont() );
+    int labelW = p.fontMetrics().boundingRect( "00" ).width() + 4;
+    int x, x2;
+    for( int s = 0; s < _turnDur; ++s )
+    {
+        x  = int(s * _pixPerSec);
+        x2 = int((s + 1) * _pixPerSec);
+        bool white = ! (s & 1);
+        if( white )
+            p.fillRect( x, 0, x2 - x, img.height(), Qt::white );
+        if( s && x2 - x >= labelW )
+        {
+            p.setPen( white ? Qt::black : Qt::white );
+            p.drawText( x + 2, 0, x2 - x - 2, img.height(),
+                        Qt::AlignLeft | Qt::AlignVCenter,
+                        QString::number( s ) );
+        }
+    }
+
+    // Turn tick.
+    p.fillRect( 0, 0, 2, img.height(), Qt::red );
+    p.end();
+
+    ScaleTile st;
+    st.zoom = _zoom;
+    st.turnDur = _turnDur;
+    _scaleTiles.push_back( st );
+    _scaleTiles.back().pix.convertFromImage( img );
+    return _scaleTiles.back().pix;
+}
+
+
+/*
+  Draw the time scale from the start of the turn containing the model
+  start time to the right edge.  Each turn is a blit of the same tile with
+  only the turn number drawn over its first second.
+*/
+void Timeline::paintTimeScale( QPainter& p, const QRect& dirty )
+{
+    const QPixmap& tile = timeScaleTile();
+    int turn = _model->startTime() / _turnDur;
+    int right = std::min( dirty.right(), width() );
+    int secW = int(_pixPerSec);
+    int x, x2, sx;
+    QString label;
+
+    p.save();
+    p.setFont( scaleFont() );
+    p.setPen( Qt::red );
+    QFontMetrics fm = p.fontMetrics();
+    for( ; ; ++turn )
+    {
+        x  = timeX( float(turn * _turnDur) );
+        x2 = timeX( float((turn + 1) * _turnDur) );
+        if( x > right )
+            break;
+        if( x2 <= SUBJECT_WIDTH )
+            continue;
+        sx = (x < SUBJECT_WIDTH) ? SUBJECT_WIDTH - x : 0;
+        p.drawPixmap( x + sx, 0, tile, sx, 0,
+                      std::min( x2 - x, tile.width() ) - sx, tile.height() );
+
+        label = QString( "T%1" ).arg( turn + 1 );
+        if( ! sx && fm.boundingRect( label ).width() + 6 <= secW )
+            p.drawText( x + 4, 0, secW - 4, tile.height(),
+                        Qt::AlignLeft | Qt::AlignVCenter, label );
+    }
+    p.restore();
+}
+
+
+/*
+  Set the zoom level.  Each ZOOM_STEPS levels doubles the scale.
+  Only the view changes as action boxes are mapped from model time.
+*/
+void Timeline::setZoom( int level )
+{
+    level = std::max( ZOOM_MIN, std::min( level, ZOOM_MAX ) );
+    if( level != _zoom )
+    {
+        _zoom = level;
+        _pixPerSec = PIX_PER_SEC * powf( 2.0f, float(level) / ZOOM_STEPS );
+        updateGeometry();
+        update();
+    }
+}
+
+
+void Timeline::zoomIn()
+{
+    setZoom( _zoom + 1 );
+}
+
+
+void Timeline::zoomOut()
+{
+    setZoom( _zoom - 1 );
+}
+
+
+void Timeline::zoomReset()
+{
+    setZoom( 0 );
 }
 
 
@@ -299,177 +303,454 @@ void Timeline::select( int index )
 {
     if( _subject != index )
     {
-        ColorLabel* cl;
-        if( (cl = selectedNameLabel()) )
+        updateRow( _subject );
+        _subject = index;
+        updateRow( _subject );
+        emit selectionChanged( _subject );
+    }
+}
+
+
+int Timeline::rowHeight( int row ) const
+{
+    int fh = fontMetrics().height();
+    int tc = _model->tokens( row ).count();
+    if( tc )
+        fh = fh * 2 + (tc - 1) / TOKEN_ROW * TOKEN_SIZE;
+    return fh + 6;
+}
+
+
+/*
+  Return the y position of the top of a subject row.  Passing
+  subjectCount() returns the bottom of the last row.
+*/
+int Timeline::rowTop( int row ) const
+{
+    return _rowY[ row ];
+}
+
+
+/*
+  Rebuild the _rowY prefix sums of the row heights.
+*/
+void Timeline::layoutRows()
+{
+    TRACE_SCOPE( "Timeline::layoutRows" );
+    int count = _model->subjectCount();
+    int y = TOP_MARGIN;
+
+    _rowY.resize( count + 1 );
+    for( int i = 0; i < count; ++i )
+    {
+        _rowY[i] = y;
+        y += rowHeight( i );
+    }
+    _rowY[ count ] = y;
+}
+
+
+/*
+  Return the x position of an absolute time in seconds.
+*/
+int Timeline::timeX( float sec ) const
+{
+    return SUBJECT_WIDTH + int((sec - _model->startTime()) * _pixPerSec);
+}
+
+
+/*
+  Return the area of a subject row.
+*/
+QRect Timeline::subjectRect( int row ) const
+{
+    return QRect( 0, rowTop( row ), width(), rowHeight( row ) );
+}
+
+
+/*
+  Schedule a repaint of a single subject row.
+*/
+void Timeline::updateRow( int row )
+{
+    if( row >= 0 && row < _model->subjectCount() )
+        update( 0, rowTop( row ), width(), rowHeight( row ) );
+}
+
+
+/*
+  Call when subjects are added or removed, or a row height changes.
+*/
+void Timeline::updateRows()
+{
+    layoutRows();
+    updateGeometry();
+    update();
+}
+
+
+QSize Timeline::sizeHint() const
+{
+    int count = _model->subjectCount();
+    return QSize( SUBJECT_WIDTH + int(_pixPerSec * _turnDur),
+                  rowTop( count ) + 1 );
+}
+
+
+QString Timeline::actionLabel( int subj, int n ) const
+{
+    const SpanList& sl = _model->spans( subj );
+    if( sl.text[n].empty() )
+        return QString( _actions->name( sl.action[n] ) );
+    return QSTR(sl.text[n]);
+}
+
+
+/*
+  Change the text of an action and mark it as resolved.
+*/
+void Timeline::setActionLabel( int subj, int n, const QString& text )
+{
+    _journal.saveLabel( *_model, subj, n );
+    _model->setLabel( subj, n, UTF8(text), SpanList::RESOLVED );
+    updateRow( subj );
+}
+
+
+static void _drawBox( QPainter& p, const QRect& box, const QColor& pen,
+                      const QColor* fill, const QString& text )
+{
+    p.setPen( pen );
+    if( fill )
+        p.setBrush( *fill );
+    else
+        p.setBrush( Qt::NoBrush );
+    p.drawRect( box.x(), box.y(), box.width()-1, box.height()-1 );
+    p.drawText( box.adjusted( 4, 3, -1, 0 ), Qt::AlignLeft | Qt::AlignTop,
+                text );
+}
+
+
+/*
+  Draw the name box & actions of a subject row which intersect the dirty
+  rectangle.
+*/
+void Timeline::paintRow( QPainter& p, int row, int y, int h,
+                         const QRect& dirty )
+{
+    QRect box( 0, y, SUBJECT_WIDTH, h );
+    QColor fill;
+
+    if( box.intersects( dirty ) )
+    {
+        if( row == _subject )
         {
-            cl->setColor( Qt::black );
-            cl->clearBase();
+            fill = QColor(RGB_SELECT);
+            _drawBox( p, box, Qt::white, &fill,
+                      QSTR(_model->subjectName( row )) );
+        }
+        else
+        {
+            _drawBox( p, box, Qt::black, NULL,
+                      QSTR(_model->subjectName( row )) );
         }
 
-        _subject = index;
+        // Tokens fill rows of TOKEN_ROW up from the bottom right.
+        const TokenSet& tokens = _model->tokens( row );
+        const uint8_t* ids = tokens.ids();
+        int tokY = y + h - TOKEN_SIZE;
+        int n;
+        for( int i = 0; i < tokens.count(); i += n, tokY -= TOKEN_SIZE )
+        {
+            n = std::min( TOKEN_ROW, tokens.count() - i );
+            tokenAtlas.drawRow( p, SUBJECT_WIDTH - n * TOKEN_SIZE, tokY,
+                                TOKEN_SIZE, ids + i, n );
+        }
+    }
+
+    const SpanList& sl = _model->spans( row );
+    int count = sl.size();
+    int right = dirty.right();
+    int x, w;
+
+    fill = QColor(RGB_RESOLVE);
+    for( int n = sl.head; n < count; ++n )
+    {
+        x = timeX( _model->visibleStart( row, n ) );
+        if( x > right )
+            break;
+        w = timeX( sl.end[n] ) - x;
+        if( x + w <= dirty.left() )
+            continue;
+        box.setRect( x, y, w, h );
+        _drawBox( p, box, Qt::darkGray,
+                  (sl.flags[n] & SpanList::RESOLVED) ? &fill : NULL,
+                  actionLabel( row, n ) );
+    }
 
-        if( (cl = selectedNameLabel()) )
+    if( _dragAction >= 0 && row == _subject )
+    {
+        // Preview of the action being dragged.
+        float t = _model->appendTime( row );
+        int dur = _actions->duration( _dragAction );
+        x = timeX( t );
+        box.setRect( x, y, timeX( t + dur ) - x, h );
+        if( box.intersects( dirty ) )
         {
-            cl->setColor( Qt::white );
-            cl->setBase( QColor(RGB_SELECT) );
+            p.setPen( QPen( Qt::darkGray, 1, Qt::DashLine ) );
+            p.setBrush( Qt::NoBrush );
+            p.drawRect( box.x(), box.y(), box.width()-1, box.height()-1 );
+            p.drawText( box.adjusted( 4, 3, -1, 0 ),
+                        Qt::AlignLeft | Qt::AlignTop,
+                        QString( "%1 (%2s)" )
+                            .arg( QString::fromUtf8( _actions->name(
+                                                        _dragAction ) ) )
+                            .arg( dur ) );
         }
     }
 }
 
 
+void Timeline::paint( QPainter& p, const QRect& dirty )
+{
+    int count = _model->subjectCount();
+    int y, h;
+
+    p.fillRect( dirty, palette().color( QPalette::Window ) );
+
+    if( dirty.top() < TOP_MARGIN )
+        paintTimeScale( p, dirty );
+
+    int i = subjectAt( QPoint( 0, dirty.top() ) );
+    if( i == SUBJECT_NONE )
+        i = (dirty.top() < TOP_MARGIN) ? 0 : count;
+    for( ; i < count; ++i )
+    {
+        y = _rowY[i];
+        if( y > dirty.bottom() )
+            break;
+        h = _rowY[i+1] - y;
+        if( y + h > dirty.top() )
+            paintRow( p, i, y, h, dirty );
+    }
+}
+
+
+void Timeline::paintEvent( QPaintEvent* ev )
+{
+    TRACE_SCOPE( "Timeline::paintEvent" );
+    QElapsedTimer timer;
+    timer.start();
+    {
+    QPainter p( this );
+    paint( p, ev->rect() );
+    }
+    if( _frameLabel )
+        _frameLabel->setText( QString( "paint %1 ms" )
+                        .arg( timer.nsecsElapsed() / 1000000.0, 0, 'f', 2 ) );
+}
+
+
 /*
-  Return layout of selected subject row or NULL if none is selected.
+  Show or hide the time taken by the last paintEvent in the top right
+  corner.  The label is opaque so updating it does not repaint the
+  timeline beneath.
 */
-QBoxLayout* Timeline::selectedLayout()
+void Timeline::showFrameTime( bool on )
 {
-    if( hasSelection() )
+    if( on && ! _frameLabel )
+    {
+        _frameLabel = new QLabel( this );
+        _frameLabel->setAutoFillBackground( true );
+        _frameLabel->setMinimumWidth( 100 );
+        _frameLabel->setAlignment( Qt::AlignRight );
+        _frameLabel->move( width() - 104, 0 );
+        _frameLabel->show();
+    }
+    else if( ! on && _frameLabel )
     {
-        QBoxLayout* slo;
-        QLayoutItem* item = _lo->itemAt( _subject );
-        if( item && (slo = static_cast<QBoxLayout*>(item->layout())) )
-            return slo;
+        delete _frameLabel;
+        _frameLabel = NULL;
     }
-    return NULL;
 }
 
 
-ColorLabel* Timeline::selectedNameLabel()
+void Timeline::resizeEvent( QResizeEvent* )
 {
-    QLayout* slo = selectedLayout();
-    if( slo )
+    if( _frameLabel )
+        _frameLabel->move( width() - _frameLabel->width() - 4, 0 );
+}
+
+
+void Timeline::changeEvent( QEvent* ev )
+{
+    if( ev->type() == QEvent::FontChange )
     {
-        ColorLabel* cl;
-        QLayoutItem* item = slo->itemAt( 0 );
-        if( item && (cl = static_cast<ColorLabel*>(item->widget())) )
-            return cl;
+        _scaleTiles.clear();
+        updateRows();
     }
-    return NULL;
+    QWidget::changeEvent( ev );
 }
 
 
-void Timeline::saveImage()
+/*
+  Return an image of the entire timeline.
+*/
+QImage Timeline::snapshot()
 {
-#ifndef _WIN32
-    QString fn( "/tmp/action-%1-%2sec.jpeg" );
-    QImage img( size(), QImage::Format_RGB888 );
-    render( &img );
-    img.save( fn.arg( QCoreApplication::applicationPid() ).arg( _startTime ) );
-#endif
+    TRACE_SCOPE( "Timeline::snapshot" );
+    QImage img( size(), QImage::Format_RGB32 );
+    QPainter p( &img );
+    p.setFont( font() );
+    paint( p, img.rect() );
+    return img;
 }
 
 
 void Timeline::advance( int sec )
 {
-    QLayout* slo;
-    QLayoutItem* item;
-    QWidget* wid;
-    int count, sc;
-    int pdur, rem, w;
-
     if( sec < 1 )
         return;
 
-    pdur = _pixPerSec * sec;
-    count = _lo->count();
-    for( int i = 0; i < count; ++i )
+    TRACE_SCOPE_ARG( "Timeline::advance", sec );
+
+    // Only subjects whose current action completes change order.
+    std::vector<int> done;
+    if( _autoOrder )
     {
-        item = _lo->itemAt(i);
-        if( item && (slo = item->layout()) )
+        float t = float(_model->startTime() + sec);
+        int count = _model->subjectCount();
+        for( int i = 0; i < count; ++i )
         {
-            rem = pdur;
-            sc = slo->count() - 1;
-            for( int ai = 1; ai < sc; ++ai )
-            {
-                item = slo->itemAt(ai);
-                w = item->geometry().width();
-                if( (wid = item->widget()) )
-                {
-                    if( rem < w )
-                        wid->setFixedWidth( w - rem );
-                    else
-                        wid->deleteLater();
-                }
-                rem -= w;
-                if( rem < 1 )
-                    break;
-            }
+            const SpanList& sl = _model->spans( i );
+            if( ! sl.empty() && sl.end[ sl.head ] <= t )
+                done.push_back( i );
         }
     }
 
-    _startTime += sec;
+    _journal.beginGroup();
+    _journal.saveAdvance( *_model, sec );
+    bool expired = _model->advance( sec );
+
+    // Their keys only increase, so each is moved later, last first, into
+    // the ordered subjects which follow it.
+    std::vector<int>::reverse_iterator it;
+    for( it = done.rbegin(); it != done.rend(); ++it )
+        moveSubject( *it, _model->laterIndex( *it ) );
+    _journal.endGroup();
+
+    if( expired || ! done.empty() )
+        updateRows();       // Row heights or order may change.
+    else
+        update();
 }
 
 
 void Timeline::setStartTime( int sec )
 {
-    _startTime = sec;
+    if( sec != _model->startTime() )
+    {
+        _journal.saveStartTime( *_model );
+        _model->setStartTime( sec );
+        update();
+    }
 }
 
 
 void Timeline::setTurnDuration( int sec )
 {
     _turnDur = sec;
-    _scale->setFixedWidth( _pixPerSec * _turnDur );
+    updateGeometry();
+    update( 0, 0, width(), TOP_MARGIN );
 }
 
 
-void Timeline::addSubject( const QString& name, bool sel )
+/*
+  Refresh the view after the model has been replaced.
+*/
+void Timeline::modelReset()
 {
-#if 1
-    ColorLabel* cl = new ColorLabel(name);
-    cl->ctype = CTYPE_NAME;
-    cl->setFixedSize( SUBJECT_WIDTH, _subjectHeight(cl) );
-    cl->setColor( Qt::black );
+    _subject = SUBJECT_NONE;
+    if( _autoOrder )
+        sortSubjects();
+    _journal.clear();
+    updateRows();
+    if( _model->subjectCount() )
+        select( 0 );
+}
 
-    QBoxLayout* slo = new QHBoxLayout;
-    slo->addWidget( cl );
-    slo->addStretch();
-    _lo->addLayout( slo );
-#else
-    _lo->addWidget( new QLabel(name) );
-#endif
+
+void Timeline::addSubject( const QString& name, bool sel )
+{
+    _journal.beginGroup();
+    int row = _model->addSubject( UTF8(name) );
+    _journal.saveAdded( row );
+    row = reorder( row );
+    _journal.endGroup();
+    updateRows();
 
     if( sel )
-        select( _lo->count() - 1 );
+        select( row );
 }
 
 
 int Timeline::subjectCount() const
 {
-    return _lo->count();
+    return _model->subjectCount();
 }
 
 
-void Timeline::renameItem( ColorLabel* cl )
+/*
+  Rename a subject (if n is -1) or one of its actions.
+*/
+void Timeline::renameItem( int subj, int n )
 {
     bool ok;
+    QString prev;
+    if( n < 0 )
+        prev = QSTR(_model->subjectName( subj ));
+    else
+        prev = actionLabel( subj, n );
+
     QString text = QInputDialog::getText(this, "Rename", "Name:",
-                            QLineEdit::Normal, cl->text(), &ok );
+                            QLineEdit::Normal, prev, &ok );
     if( ok && ! text.isEmpty() )
-        cl->setText( text );
+    {
+        if( n < 0 )
+        {
+            _journal.saveName( *_model, subj );
+            _model->setSubjectName( subj, UTF8(text) );
+        }
+        else
+        {
+            _journal.saveLabel( *_model, subj, n );
+            _model->setLabel( subj, n, UTF8(text),
+                              _model->spans( subj ).flags[n] );
+        }
+        updateRow( subj );
+    }
 }
 
 
 void Timeline::renameSubject()
 {
-    ColorLabel* cl;
-    if( (cl = selectedNameLabel()) )
-        renameItem( cl );
+    if( hasSelection() )
+        renameItem( _subject, -1 );
 }
 
 
 bool Timeline::appendAction( int id )
 {
-    QBoxLayout* slo = selectedLayout();
-    if( slo )
+    if( hasSelection() )
     {
-        ColorLabel* cl = new ColorLabel( _actions->name(id) );
-        cl->ctype = CTYPE_ACTION;
-        cl->setFixedSize( _pixPerSec * _actions->duration(id),
-                          _subjectHeight(cl) );
-        cl->setColor( Qt::darkGray );
-
-        slo->insertWidget( slo->count() - 1, cl );
+        int subj = _subject;
+        _journal.beginGroup();
+        _journal.saveAppend( *_model, subj );
+        _model->appendAction( subj, id, float(_actions->duration(id)) );
+        int row = reorder( subj );
+        if( row == subj )
+            updateRow( subj );
+        _journal.endGroup();
         return true;
     }
     return false;
@@ -478,14 +759,15 @@ bool Timeline::appendAction( int id )
 
 void Timeline::dragEnterEvent(QDragEnterEvent* ev)
 {
-#if 0
-    QStringList fmt = ev->mimeData()->formats();
-    for (int i = 0; i < fmt.size(); ++i)
-        printf( "fmt %s\n", CSTR(fmt.at(i)) );
-#endif
-
-    if( ev->mimeData()->hasFormat("application/x-qabstractitemmodeldatalist") )
-         ev->acceptProposedAction();
+    const QMimeData* mime = ev->mimeData();
+    _dragAction = mimeActionId( mime, *_actions );
+    if( _dragAction < 0 && mime->hasText() )
+        _dragAction = _actions->actionId( UTF8(mime->text()) );
+    if( _dragAction >= 0 )
+    {
+        updateRow( _subject );
+        ev->acceptProposedAction();
+    }
 }
 
 
@@ -495,45 +777,58 @@ void Timeline::dragEnterEvent(QDragEnterEvent* ev)
 #define POS_I(ev)    ev->pos()
 #endif
 
+/*
+  Select the hovered subject and show where the dragged action would be
+  placed.
+*/
 void Timeline::dragMoveEvent(QDragMoveEvent* ev)
 {
     int n = subjectAt( POS_I(ev) );
     if( n != SUBJECT_NONE )
         select(n);
-    if( hasSelection() )
+    if( hasSelection() && _dragAction >= 0 )
         ev->acceptProposedAction();
 }
 
 
-void Timeline::dropEvent(QDropEvent* ev)
+void Timeline::dragLeaveEvent(QDragLeaveEvent*)
 {
-    QStandardItemModel model;
-    model.dropMimeData( ev->mimeData(), Qt::CopyAction, 0, 0, QModelIndex() );
-    QString name( model.item(0, 0)->text() );
-    //printf( "drop %s\n", CSTR(name) );
+    _dragAction = -1;
+    updateRow( _subject );
+}
+
 
-    int id = _actions->actionId(CSTR(name));
+void Timeline::dropEvent(QDropEvent* ev)
+{
+    int id = _dragAction;
+    _dragAction = -1;
+    //printf( "drop %d\n", id );
     if( id >= 0 && appendAction( id ) )
         ev->acceptProposedAction();
+    else
+        updateRow( _subject );
 }
 
 
 void Timeline::contextMenuEvent(QContextMenuEvent* ev)
 {
-    QWidget* wid = childAt( ev->pos() );
-    if( wid )
+    int row, span;
+    if( itemAt( ev->pos(), row, span ) )
     {
         QMenu menu;
         QAction* resolv = NULL;
+        QAction* resolvAll = NULL;
         QAction* done   = NULL;
         QAction* resize = NULL;
+        QAction* init   = NULL;
         QAction* rename;
         QAction* act;
-        ColorLabel* cl = static_cast<ColorLabel*>( wid );
+        const TokenSet& tokens = _model->tokens( row );
 
-        if( cl->ctype == CTYPE_ACTION )
+        if( span >= 0 )
         {
             resolv = menu.addAction( "Resolve" );
+            resolvAll = menu.addAction( "Resolve All" );
             done   = menu.addAction( "Mark Done" );
             resize = menu.addAction( "Set Duration" );
         }
@@ -542,16 +837,19 @@ void Timeline::contextMenuEvent(QContextMenuEvent* ev)
             prepareTokenMenu( &menu );
 
             _tokenRemoved = -1;
-            if( cl->tokenCount )
+            if( tokens.count() )
             {
                 TokenMenu* rtok = new TokenMenu("Remove Token", &menu);
                 PixmapChooser* pmc = rtok->chooser();
-                pmc->setColumns( cl->tokenCount );
-                for( int i = 0; i < cl->tokenCount; ++i )
-                    pmc->addPixmap( ColorLabel::tokenPixmap[ cl->token[i] ] );
+                pmc->setColumns( std::min( tokens.count(), TOKEN_ROW ) );
+                pmc->setAtlas( &tokenAtlas );
+                pmc->clear();
+                for( int i = 0; i < tokens.count(); ++i )
+                    pmc->addPixmap( tokens.ids()[i] );
                 connect(pmc, SIGNAL(selected(int)), SLOT(recordTokenRem(int)));
                 menu.addMenu( rtok );
             }
+            init = menu.addAction( "Set Initiative" );
         }
         rename = menu.addAction( "Rename" );
         menu.addSeparator();
@@ -563,109 +861,232 @@ void Timeline::contextMenuEvent(QContextMenuEvent* ev)
         {
             if( act == resolv )
             {
-                emit resolve(cl);
+                emit resolve( row, span );
+            }
+            else if( act == resolvAll )
+            {
+                emit resolveAll( _model->spans( row ).action[ span ] );
             }
             else if( act == done )
             {
-                QString text( cl->text() );
+                QString text( actionLabel( row, span ) );
                 text.append( ' ' );
                 text.append( QChar(0x2713) );
-                cl->setText( text );
-                cl->setBase( QColor(RGB_RESOLVE) );
+                setActionLabel( row, span, text );
             }
             else if( act == rename )
             {
-                renameItem( cl );
+                renameItem( row, span );
+            }
+            else if( act == init )
+            {
+                bool ok;
+                int value = QInputDialog::getInt( this, "Set Initiative",
+                        "Initiative (higher goes first on ties):",
+                        _model->initiative( row ), -999, 999, 1, &ok );
+                if( ok )
+                    setInitiative( row, value );
             }
             else if( act == resize )
             {
                 bool ok;
                 double dur = QInputDialog::getDouble(this,
                         "Set Duration", "Duration:",
-                        double(cl->width()) / double(_pixPerSec), 0.1, 10.0,
+                        _model->duration( row, span ), 0.1, 10.0,
                         1, &ok );
                 if( ok )
-                    cl->setFixedWidth( int(dur * _pixPerSec) );
+                {
+                    _journal.beginGroup();
+                    _journal.saveDuration( *_model, row, span );
+                    _model->setDuration( row, span, float(dur) );
+                    int moved = reorder( row );
+                    if( moved == row )
+                        updateRow( row );
+                    _journal.endGroup();
+                }
             }
             else    // delete
             {
-                if( cl->ctype == CTYPE_ACTION )
-                    wid->deleteLater();
+                if( span >= 0 )
+                {
+                    _journal.beginGroup();
+                    _journal.saveRemoveAction( *_model, row, span );
+                    _model->removeAction( row, span );
+                    int moved = reorder( row );
+                    if( moved == row )
+                        updateRow( row );
+                    _journal.endGroup();
+                }
                 else
-                    deleteSubject( subjectAt( ev->pos() ) );
+                    deleteSubject( row );
             }
         }
-        else if( cl->ctype == CTYPE_NAME )
+        else if( span < 0 )
         {
             if( _tokenItem >= 0 )
             {
-                cl->addToken( _tokenItem );
-                cl->setFixedHeight( _subjectHeight(cl) );
+                bool ok;
+                int dur = QInputDialog::getInt( this, "Add Token",
+                        "Duration in seconds (0 lasts until removed):",
+                        TOKEN_FOREVER, 0, 0xffff, 1, &ok );
+                if( ok )
+                {
+                    _journal.saveTokens( *_model, row );
+                    _model->addToken( row, _tokenItem, dur );
+                    updateRows();
+                }
             }
-            else if( _tokenRemoved >= 0 )
+            else if( _tokenRemoved >= 0 &&
+                     _tokenRemoved < _model->tokens( row ).count() )
             {
-                cl->removeToken( _tokenRemoved );
+                _journal.saveTokens( *_model, row );
+                _model->removeToken( row, _tokenRemoved );
+                updateRows();
             }
         }
     }
 }
 
 
+/*
+  Return the subject row at a point or SUBJECT_NONE.
+*/
 int Timeline::subjectAt(const QPoint& pnt) const
 {
-    QLayoutItem* item;
-    int count = _lo->count();
-    for( int i = 0; i < count; ++i )
+    // Find the first row bottom below the point.
+    std::vector<int>::const_iterator it =
+        std::upper_bound( _rowY.begin() + 1, _rowY.end(), pnt.y() );
+    if( pnt.y() < TOP_MARGIN || it == _rowY.end() )
+        return SUBJECT_NONE;
+    return int(it - _rowY.begin()) - 1;
+}
+
+
+/*
+  Compare an x position to the span end time as mapped by Timeline::timeX().
+*/
+struct SpanEndX
+{
+    int start;
+    float pixPerSec;
+
+    SpanEndX( int st, float pps ) : start(st), pixPerSec(pps) {}
+    bool operator()( int x, float end ) const
+    {
+        return x < SUBJECT_WIDTH + int((end - start) * pixPerSec);
+    }
+};
+
+
+/*
+  Find the subject row and action at a point.  The span is set to -1 if
+  the point is over the subject name.  Return false if nothing is there.
+*/
+bool Timeline::itemAt( const QPoint& pnt, int& row, int& span ) const
+{
+    row = subjectAt( pnt );
+    if( row == SUBJECT_NONE )
+        return false;
+
+    if( pnt.x() < SUBJECT_WIDTH )
     {
-        item = _lo->itemAt(i);
-        if( item->geometry().contains( pnt ) )
-            return i;
+        span = -1;
+        return true;
     }
-    return SUBJECT_NONE;
+
+    // Span end times are sorted so the first ending after the point is
+    // found with a binary search.
+    const SpanList& sl = _model->spans( row );
+    std::vector<float>::const_iterator it =
+        std::upper_bound( sl.end.begin() + sl.head, sl.end.end(), pnt.x(),
+                          SpanEndX( _model->startTime(), _pixPerSec ) );
+    if( it == sl.end.end() )
+        return false;
+    span = int(it - sl.end.begin());
+    return true;
 }
 
 
 void Timeline::deleteSubject( int i )
 {
-    QLayoutItem* item = _lo->takeAt(i);
-    if( item )
+    if( i >= 0 && i < _model->subjectCount() )
     {
-        QWidget* wid;
-        QLayout* slo = item->layout();
-        int sc = slo->count() - 1;
-        for( int ai = 0; ai < sc; ++ai )
-        {
-            item = slo->itemAt(ai);
-            if( item && (wid = item->widget()) )
-                delete wid;
-        }
-        delete item;
+        _journal.saveRemove( *_model, i );
+        _model->removeSubject( i );
+        if( _subject == i )
+            _subject = SUBJECT_NONE;
+        else if( _subject > i )
+            --_subject;
+        updateRows();
     }
 }
 
 
 /*
-  Return the last action of the selected subject or NULL if there is none.
+  Return the index of the last action of the selected subject or -1 if
+  there is none.
 */
-ColorLabel* Timeline::lastAction()
+int Timeline::lastAction() const
+{
+    if( hasSelection() )
+        return _model->lastAction( _subject );
+    return -1;
+}
+
+
+void Timeline::deleteLastAction()
 {
-    QBoxLayout* slo = selectedLayout();
-    if( slo && slo->count() > 2 )
+    int n = lastAction();
+    if( n >= 0 )
     {
-        QWidget* wid;
-        QLayoutItem* item = slo->itemAt( slo->count() - 2 );
-        if( item && (wid = item->widget()) )
-            return static_cast<ColorLabel*>( wid );
+        int subj = _subject;
+        _journal.beginGroup();
+        _journal.saveRemoveAction( *_model, subj, n );
+        _model->removeAction( subj, n );
+        int row = reorder( subj );
+        if( row == subj )
+            updateRow( subj );
+        _journal.endGroup();
     }
-    return NULL;
 }
 
 
-void Timeline::deleteLastAction()
+/*
+  Revert the last edit.  Return false if there is nothing to undo.
+*/
+bool Timeline::undo()
+{
+    if( ! _journal.undo( *_model ) )
+        return false;
+    restored();
+    return true;
+}
+
+
+bool Timeline::redo()
 {
-    ColorLabel* cl = lastAction();
-    if( cl )
-        cl->deleteLater();
+    if( ! _journal.redo( *_model ) )
+        return false;
+    restored();
+    return true;
+}
+
+
+/*
+  Refresh the view after the journal has changed the model.
+*/
+void Timeline::restored()
+{
+    int count = _model->subjectCount();
+    if( _subject >= count )
+        _subject = count ? count - 1 : SUBJECT_NONE;
+
+    // Undoing the sort done when Auto was turned on, or edits made before
+    // then, leaves the subjects out of order.  The journal records subject
+    // indices so they cannot be re-sorted here; Auto is turned off instead.
+    if( _autoOrder && ! _model->inOrder() )
+        setAutoOrder( false );
+    updateRows();
 }
 
 
@@ -677,50 +1098,144 @@ void Timeline::mousePressEvent(QMouseEvent* ev)
 }
 
 
-void Timeline::orderSubject( int dir )
+void Timeline::orderSubject( int dir )
+{
+    int count = _model->subjectCount();
+    if( count > 1 && hasSelection() )
+    {
+        int n;
+
+        // Manual ordering ends automatic ordering.
+        setAutoOrder( false );
+
+        if( dir < 0 )
+        {
+            n = (_subject > 0) ? _subject-1 : count-1;
+        }
+        else
+        {
+            n = _subject+1;
+            if( n == count )
+                n = 0;
+        }
+
+        _journal.saveMove( _subject, n );
+        _model->moveSubject( _subject, n );
+        _subject = n;   // No need to call select().
+        updateRows();
+        emit selectionChanged( _subject );
+    }
+}
+
+
+/*
+  Move a subject row, keeping the same subject selected.
+*/
+void Timeline::moveSubject( int from, int to )
+{
+    if( from == to )
+        return;
+    _journal.saveMove( from, to );
+    _model->moveSubject( from, to );
+
+    if( _subject == from )
+        _subject = to;
+    else if( from < to && _subject > from && _subject <= to )
+        --_subject;
+    else if( to < from && _subject >= to && _subject < from )
+        ++_subject;
+}
+
+
+/*
+  Move a subject to its place in initiative order after its actions have
+  changed.  Only a binary search of the other (ordered) subjects is done.
+  Return the new index of the subject.
+*/
+int Timeline::reorder( int subj )
+{
+    if( ! _autoOrder )
+        return subj;
+    int n = _model->orderedIndex( subj );
+    if( n != subj )
+    {
+        moveSubject( subj, n );
+        updateRows();
+    }
+    return n;
+}
+
+
+/*
+  Put all subjects into initiative order with a binary insertion sort.
+*/
+void Timeline::sortSubjects()
+{
+    int count = _model->subjectCount();
+    _journal.beginGroup();
+    for( int i = 1; i < count; ++i )
+        moveSubject( i, _model->earlierIndex( i ) );
+    _journal.endGroup();
+}
+
+
+/*
+  Enable or disable keeping the subjects ordered by the time their current
+  action completes.  When enabled the subjects are sorted immediately.
+*/
+void Timeline::setAutoOrder( bool on )
 {
-    int count = _lo->count();
-    if( count > 1 && hasSelection() )
+    if( on == _autoOrder )
+        return;
+    _autoOrder = on;
+    if( on )
     {
-        int n;
-        if( dir < 0 )
-        {
-            n = (_subject > 0) ? _subject-1 : count-1;
-        }
-        else
-        {
-            n = _subject+1;
-            if( n == count )
-                n = 0;
-        }
-
-        QLayoutItem* item = _lo->takeAt( _subject );
-
-        // With Qt 5.12.5 takeAt() sets the item layout parent to 0, but
-        // insertItem() below does not set it again.  If the parent is not set
-        // again here then no further widgets can be added to the subject
-        // layout and the item->geometry() will be 0,0,0,0.
+        sortSubjects();
+        updateRows();
+        emit selectionChanged( _subject );
+    }
+    emit autoOrderChanged( on );
+}
 
-        QLayout* slo = item->layout();
-        if( ! slo->parent() )
-            slo->setParent( _lo );
 
-        _lo->insertItem( n, item );
-        _subject = n;   // No need to call select().
-    }
+/*
+  Set the initiative stat used to order subjects whose current actions
+  complete at the same time.
+*/
+void Timeline::setInitiative( int subj, int value )
+{
+    if( value == _model->initiative( subj ) )
+        return;
+    _journal.beginGroup();
+    _journal.saveInitiative( *_model, subj );
+    _model->setInitiative( subj, value );
+    reorder( subj );
+    _journal.endGroup();
 }
 
 
 void Timeline::wheelEvent(QWheelEvent* ev)
 {
-    if( ev->modifiers() & Qt::ShiftModifier )
+    if( ev->modifiers() & Qt::ControlModifier )
+    {
+        // Accumulate the angle so high resolution wheels & touchpads
+        // zoom smoothly rather than one level per event.
+        _wheelZoom += ev->angleDelta().y();
+        int steps = _wheelZoom / 120;
+        if( steps )
+        {
+            _wheelZoom -= steps * 120;
+            setZoom( _zoom + steps );
+        }
+    }
+    else if( ev->modifiers() & Qt::ShiftModifier )
     {
         orderSubject( (ev->angleDelta().y() > 0) ? -1 : 1 );
     }
     else
     {
         int n = 0;
-        int count = _lo->count();
+        int count = _model->subjectCount();
         if( count && hasSelection() )
         {
             if( ev->angleDelta().y() > 0 )
@@ -742,45 +1257,43 @@ void Timeline::wheelEvent(QWheelEvent* ev)
 //----------------------------------------------------------------------------
 
 
-struct InitialAction
-{
-    const char* name;
-    int dur;
-};
-
-#define ACT_COUNT   14
-static const InitialAction _initAction[ ACT_COUNT ] =
-{
-    { "Walk 10", 3 },
-    { "Run 10",  1 },
-    { "Attack",  5 },
-    { "Defend",  5 },
-    { "Shoot",   5 },
-    { "Aimed Shot", 7 },
-    { "Quick Shot", 4 },
-    { "Drink",   5 },
-    { "Draw",    1 },
-    { "Equip",   6 },
-    { "Pickup",  3 },
-    { "Throw",   3 },
-    { "Wait 1",  1 },
-    { "Wait 2",  2 }
-};
-
-
 ActionTimeline::ActionTimeline( QWidget* parent ) : QWidget(parent)
 {
     setWindowTitle( "Action Timeline" );
 
-    _tl = new Timeline( &_at );
-    connect( _tl, SIGNAL(resolve(ColorLabel*)), SLOT(rollDice(ColorLabel*)) );
-
-    _actList = new QListWidget;
+    _tl = new Timeline( &_at, &_model );
+    connect( _tl, SIGNAL(resolve(int,int)), SLOT(rollDice(int,int)) );
+    connect( _tl, SIGNAL(resolveAll(int)), SLOT(rollDiceGroup(int)) );
+
+    // Queued so the scroll area has handled the new timeline size when
+    // a subject is added.
+    connect( _tl, SIGNAL(selectionChanged(int)), SLOT(showSubject(int)),
+             Qt::QueuedConnection );
+
+    // Only the rows within the viewport are painted so large encounters
+    // cost no more to draw than small ones.
+    _scroll = new QScrollArea;
+    _scroll->setWidget( _tl );
+    _scroll->setWidgetResizable( true );
+    _scroll->setFrameShape( QFrame::NoFrame );
+
+    _actModel = new ActionListModel( &_at, this );
+    _actList = new QListView;
+    _actList->setModel( _actModel );
+    _actList->setUniformItemSizes( true );
     _actList->setDragEnabled(true);
     _actList->setMaximumWidth( 180 );
     _actList->setSizePolicy( QSizePolicy::Maximum, QSizePolicy::Expanding );
-    connect( _actList, SIGNAL(itemActivated(QListWidgetItem*)),
-             SLOT(appendAction(QListWidgetItem*)) );
+    connect( _actList, SIGNAL(activated(const QModelIndex&)),
+             SLOT(appendAction(const QModelIndex&)) );
+
+    _actFilter = new QLineEdit;
+    _actFilter->setMaximumWidth( 180 );
+    _actFilter->setPlaceholderText( "Filter actions" );
+    _actFilter->setClearButtonEnabled( true );
+    connect( _actFilter, SIGNAL(textChanged(const QString&)),
+             SLOT(filterActions(const QString&)) );
+    connect( _actFilter, SIGNAL(returnPressed()), SLOT(appendFirstAction()) );
 
     QPushButton* add = new QPushButton;
     add->setIcon( QIcon(":/icon/new_pc-32.png") );
@@ -792,6 +1305,13 @@ ActionTimeline::ActionTimeline( QWidget* parent ) : QWidget(parent)
     QPushButton* down = new QPushButton;
     connect( down, SIGNAL(clicked(bool)), this, SLOT(subjectDown()) );
 
+    QPushButton* order = new QPushButton( "Auto" );
+    order->setToolTip( "Order by action completion & initiative" );
+    order->setCheckable( true );
+    connect( order, SIGNAL(toggled(bool)), _tl, SLOT(setAutoOrder(bool)) );
+    connect( _tl, SIGNAL(autoOrderChanged(bool)),
+             order, SLOT(setChecked(bool)) );
+
     _turn = new QComboBox;
     _turn->addItem( "6 sec" );
     _turn->addItem( "10 sec" );
@@ -837,6 +1357,7 @@ ActionTimeline::ActionTimeline( QWidget* parent ) : QWidget(parent)
     lo->addWidget( add );
     lo->addWidget( up );
     lo->addWidget( down );
+    lo->addWidget( order );
     lo->addSpacing( 32 );
     lo->addWidget( _turn );
     lo->addWidget( adv );
@@ -848,23 +1369,33 @@ ActionTimeline::ActionTimeline( QWidget* parent ) : QWidget(parent)
     lo->addWidget( about );
 
     QGridLayout* grid = new QGridLayout(this);
-    grid->addWidget( _tl,      0, 0 );
-    grid->addWidget( _actList, 0, 1, 2, 2 );
+    grid->addWidget( _scroll,  0, 0 );
+    {
+    QBoxLayout* side = new QVBoxLayout;
+    side->addWidget( _actFilter );
+    side->addWidget( _actList );
+    grid->addLayout( side, 0, 1, 2, 2 );
+    }
     grid->addLayout( lo,       1, 0 );
 
     addQAction( QKeySequence(Qt::Key_F2),         _tl,  SLOT(renameSubject()) );
     addQAction( QKeySequence(Qt::Key_F5),         this, SLOT(rollDiceLast()) );
+    addQAction( QKeySequence(Qt::Key_F6),         this, SLOT(showOdds()) );
     addQAction( QKeySequence(Qt::CTRL|Qt::Key_T), this, SLOT(advance()) );
+    addQAction( QKeySequence::Open,               this, SLOT(openSession()) );
+    addQAction( QKeySequence::Save,               this, SLOT(saveSession()) );
+    addQAction( QKeySequence(Qt::CTRL|Qt::Key_I), this, SLOT(importLibrary()) );
+    addQAction( QKeySequence::ZoomIn,             _tl,  SLOT(zoomIn()) );
+    addQAction( QKeySequence::ZoomOut,            _tl,  SLOT(zoomOut()) );
+    addQAction( QKeySequence(Qt::CTRL|Qt::Key_0), _tl,  SLOT(zoomReset()) );
+    addQAction( QKeySequence::Undo,               this, SLOT(undo()) );
+    addQAction( QKeySequence::Redo,               this, SLOT(redo()) );
     addQAction( QKeySequence::HelpContents,       this, SLOT(showAbout()) );
     addQAction( QKeySequence::Quit,               this, SLOT(close()) );
 
     // Built-in character actions.
-    for( int i = 0; i < ACT_COUNT; ++i )
-    {
-        const char* name = _initAction[i].name;
-        _at.defineAction( name, name + strlen(name), _initAction[i].dur );
-        new QListWidgetItem( QString(name), _actList, i );
-    }
+    _at.defineBuiltins();
+    _actModel->actionsAdded();
 
     showTime( 0 );
 }
@@ -882,28 +1413,28 @@ void ActionTimeline::addQAction( const QKeySequence& key,
 
 void ActionTimeline::parseArgs( int argc, char** argv )
 {
-    std::vector<char> nameBuf;
     char* cp;
     bool select = true;
 
     for( int i = 0; i < argc; ++i )
     {
-        if( (cp = strchr(argv[i], ':')) )
+        if( argv[i][0] == '-' && argv[i][1] )
+        {
+            i = parseOption( argc, argv, i );
+        }
+        else if( (cp = strchr(argv[i], ':')) )
         {
-            nameBuf.assign( argv[i], cp );
-            nameBuf.push_back( '\0' );
-
             int dur = atoi(cp+1);
             if( dur < 1 )
                 dur = 1;
             else if( dur > 10 )
                 dur = 10;
 
-            int id = _at.actionId( nameBuf.data() );
+            int id = _at.actionId( argv[i], cp );
             if( id < 0 )
             {
-                id = _at.defineAction( argv[i], cp, dur );
-                new QListWidgetItem( QString(_at.name(id)), _actList, id );
+                _at.defineAction( argv[i], cp, dur );
+                _actModel->actionsAdded();
             }
             else
             {
@@ -946,9 +1477,26 @@ void ActionTimeline::turnDurationChanged(int index)
 }
 
 
-void ActionTimeline::appendAction(QListWidgetItem* item)
+void ActionTimeline::appendAction(const QModelIndex& index)
+{
+    _tl->appendAction( index.data( ROLE_ACTION_ID ).toInt() );
+}
+
+
+void ActionTimeline::filterActions(const QString& text)
+{
+    _actModel->setFilter( text );
+}
+
+
+/*
+  Append the first action shown in the (filtered) list.
+*/
+void ActionTimeline::appendFirstAction()
 {
-    _tl->appendAction( item->type() );
+    QModelIndex index( _actModel->index( 0 ) );
+    if( index.isValid() )
+        appendAction( index );
 }
 
 
@@ -966,17 +1514,142 @@ void ActionTimeline::showTime( int sec, bool setEditField )
 }
 
 
+/*
+  Scroll the timeline to show a subject row.
+*/
+void ActionTimeline::showSubject( int subj )
+{
+    if( subj >= 0 && subj < _tl->subjectCount() )
+    {
+        QRect r = _tl->subjectRect( subj );
+        _scroll->ensureVisible( r.x(), r.center().y(), 0, r.height() / 2 );
+    }
+}
+
+
+#define SESSION_FILTER  "Action Timeline Sessions (*.atl);;All Files (*)"
+
+void ActionTimeline::openSession()
+{
+    QString fn = QFileDialog::getOpenFileName( this, "Open Session",
+                                               _sessionFile, SESSION_FILTER );
+    if( ! fn.isEmpty() )
+        loadSession( fn );
+}
+
+
+void ActionTimeline::saveSession()
+{
+    QString fn = QFileDialog::getSaveFileName( this, "Save Session",
+                                               _sessionFile, SESSION_FILTER );
+    if( fn.isEmpty() )
+        return;
+
+    const char* err = writeSession( fn, _at, _model,
+                                    _turn->currentIndex() ? 10 : 6 );
+    if( err )
+        QMessageBox::warning( this, "Save Session", err );
+    else
+        _sessionFile = fn;
+}
+
+
+void ActionTimeline::importLibrary()
+{
+    QString fn = QFileDialog::getOpenFileName( this, "Import Actions",
+                    QString(), "Action Libraries (*.csv *.jsonl *.json);;"
+                               "All Files (*)" );
+    if( ! fn.isEmpty() )
+        importLibrary( fn );
+}
+
+
+/*
+  Define the actions from a CSV or JSON lines file.
+*/
+bool ActionTimeline::importLibrary( const QString& file )
+{
+    int skipped;
+    int added = importActions( file, _at, &skipped );
+    if( added < 0 )
+    {
+        QMessageBox::warning( this, "Import Actions",
+                              QString( "Cannot read %1" ).arg( file ) );
+        return false;
+    }
+    _actModel->actionsAdded();
+
+    if( skipped )
+    {
+        QMessageBox::warning( this, "Import Actions",
+                QString( "Skipped %1 invalid lines in %2" )
+                    .arg( skipped ).arg( file ) );
+    }
+    return true;
+}
+
+
+/*
+  Replace the current encounter with one from a session file.
+*/
+bool ActionTimeline::loadSession( const QString& file )
+{
+    int turnDur;
+    const char* err = readSession( file, _at, _model, turnDur );
+    if( err )
+    {
+        QMessageBox::warning( this, "Open Session",
+                              QString( "%1\n%2" ).arg( err ).arg( file ) );
+        return false;
+    }
+    _sessionFile = file;
+
+    // Drop any tokens without a pixmap.
+    int tokenCount = Timeline::tokenAtlas.count();
+    for( int i = 0; i < _model.subjectCount(); ++i )
+    {
+        for( int t = _model.tokens( i ).count() - 1; t >= 0; --t )
+        {
+            if( _model.tokens( i ).ids()[t] >= tokenCount )
+                _model.removeToken( i, t );
+        }
+    }
+
+    _actModel->reset();
+
+    _turn->setCurrentIndex( (turnDur == 10) ? 1 : 0 );
+    _tl->modelReset();
+    showTime( _model.startTime() );
+    return true;
+}
+
+
 void ActionTimeline::advance()
 {
     int turnDur = _turn->currentIndex() ? 10 : 6;
 
-    _tl->saveImage();
+    if( _snap.enabled() )
+        _snap.queue( _tl->snapshot(), _tl->startTime() );
     _tl->advance( turnDur );
 
     showTime( _tl->startTime() );
 }
 
 
+void ActionTimeline::undo()
+{
+    if( _tl->undo() )
+        showTime( _tl->startTime() );
+}
+
+
+void ActionTimeline::redo()
+{
+    if( _tl->redo() )
+        showTime( _tl->startTime() );
+}
+
+
 void ActionTimeline::timeEdited()
 {
     int sec = _time->text().toInt();
@@ -985,55 +1658,396 @@ void ActionTimeline::timeEdited()
 }
 
 
-#if QT_VERSION < QT_VERSION_CHECK(5, 10, 0)
-#define DICE_ROLL(n)    (qrand() % n + 1)
-#else
-#include <QRandomGenerator>
-#define DICE_ROLL(n)    (QRandomGenerator::global()->bounded(n) + 1)
-#endif
-
 #include "evalDice.c"
+#include "diceDist.c"
+
+#define DICE_SEQ    0x41544c     // Stream selector of the session rng.
+
+static DiceRng _diceRng;
+static RollLog _rollLog;
+
 
+/*
+  Restart the session rng stream.
+*/
+static void seedDice( uint64_t seed )
+{
+    diceSeed( &_diceRng, seed, DICE_SEQ );
+    _rollLog.setSeed( seed );
+}
+
+
+#define ROLL_BUFFER_MAX  64
+
+struct RollBuffer
+{
+    int value[ ROLL_BUFFER_MAX ];
+    int count;
+};
 
 static void _emit(void* user, int n)
 {
-    static_cast< QVector<int>* >(user)->push_back( n );
+    RollBuffer* buf = static_cast<RollBuffer*>(user);
+    if( buf->count < ROLL_BUFFER_MAX )
+        buf->value[ buf->count ] = n;
+    ++buf->count;
+}
+
+// Return the number of die values to log for a roll.
+static inline int _loggedDice( const RollBuffer& buf )
+{
+    return (buf.count <= ROLL_BUFFER_MAX) ? buf.count : 0;
+}
+
+
+/*
+  Return the compiled program for the current dice spec, or an empty array
+  if the spec is invalid.  Programs for specs in the _dice history are
+  cached in the item data.
+*/
+QByteArray ActionTimeline::diceProgram()
+{
+    QString spec( _dice->currentText() );
+    int i = _dice->findText( spec );
+    if( i >= 0 )
+    {
+        QVariant cached( _dice->itemData( i ) );
+        if( cached.isValid() )
+            return cached.toByteArray();
+    }
+
+    DiceOp ops[ DICE_OP_MAX ];
+    int len = compileDice( CSTR(spec), ops );
+    if( len < 0 )
+    {
+        QMessageBox::warning( this, "Dice",
+                              "Invalid dice specification." );
+        return QByteArray();
+    }
+
+    QByteArray prog( reinterpret_cast<const char*>(ops),
+                     len * sizeof(DiceOp) );
+    if( i >= 0 )
+        _dice->setItemData( i, prog );
+    return prog;
+}
+
+
+#define PROG_OPS(prog) \
+    reinterpret_cast<const DiceOp*>(prog.constData()), \
+    prog.size() / sizeof(DiceOp)
+
+
+/*
+  Append the kept die values & total of a roll to an action label.
+  The dice are only shown when there is more than one and they fit in
+  a RollBuffer.
+*/
+static void _appendRoll( QString& str, const int* dice, int count,
+                         int total )
+{
+    if( count > 1 && count <= ROLL_BUFFER_MAX )
+    {
+        str.append( " (" );
+        for( int i = 0; i < count; ++i )
+        {
+            if( i )
+                str.append( ',' );
+            str.append( QString::number( dice[i] ) );
+        }
+        str.append( ')' );
+    }
+    str.append( ' ' );
+    str.append( QString::number(total) );
 }
 
 
-void ActionTimeline::rollDice( ColorLabel* cl )
+void ActionTimeline::rollDice( int subj, int n )
 {
-    if( cl )
+    TRACE_SCOPE( "ActionTimeline::rollDice" );
+    if( n >= 0 )
     {
-        QVector<int> buf;
-        int len, n;
-        int total = evalDice( CSTR(_dice->currentText()), _emit, &buf );
+        QByteArray prog( diceProgram() );
+        if( prog.isEmpty() )
+            return;
+
+        RollBuffer buf;
+        buf.count = 0;
+        uint64_t offset = _diceRng.draws;
+        int total = evalDiceProgram( &_diceRng, PROG_OPS(prog), _emit, &buf );
+        _rollLog.append( offset, CSTR(_dice->currentText()), total,
+                         buf.value, _loggedDice( buf ) );
+
+        QString str( _tl->actionLabel( subj, n ) );
+        _appendRoll( str, buf.value, buf.count, total );
+        _tl->setActionLabel( subj, n, str );
+    }
+}
 
-        QString str( cl->text() );
-        if( (len = buf.size()) > 1 )
+
+/*
+  Resolve all unresolved instances of an action on the timeline with a
+  single batch of rolls.
+*/
+void ActionTimeline::rollDiceGroup( int action )
+{
+    TRACE_SCOPE( "ActionTimeline::rollDiceGroup" );
+    std::vector<int> target;    // Pairs of subject & span index.
+    int subjects = _model.subjectCount();
+    for( int i = 0; i < subjects; ++i )
+    {
+        const SpanList& sl = _model.spans( i );
+        for( int n = sl.head; n < sl.size(); ++n )
         {
-            str.append( " (" );
-            for( int i = 0; i < len; ++i )
+            if( sl.action[n] == action && ! (sl.flags[n] & SpanList::RESOLVED) )
             {
-                n = buf[i];
-                if( i && n >= 0 )
-                    str.append( '+' );
-                str.append( QString::number( n ) );
+                target.push_back( i );
+                target.push_back( n );
             }
-            str.append( ')' );
         }
-        str.append( ' ' );
-        str.append( QString::number(total) );
+    }
+
+    int count = target.size() / 2;
+    if( ! count )
+        return;
+
+    QByteArray prog( diceProgram() );
+    if( prog.isEmpty() )
+        return;
+
+    _tl->journal().beginGroup();
+
+    // Per-die values are only kept when they will be shown.
+    int diceCount = diceProgramDice( PROG_OPS(prog) );
+    if( diceCount > ROLL_BUFFER_MAX )
+        diceCount = 0;
+    std::vector<int> sums( count );
+    std::vector<int> dice( count * diceCount );
+    std::vector<uint64_t> offsets( count );
+
+    evalDiceBatch( &_diceRng, PROG_OPS(prog), count, sums.data(),
+                   diceCount ? dice.data() : NULL, offsets.data() );
+
+    QByteArray spec( _dice->currentText().toLocal8Bit() );
+    for( int r = 0; r < count; ++r )
+    {
+        _rollLog.append( offsets[r], spec.constData(), sums[r],
+                         dice.data() + r * diceCount, diceCount );
+
+        int subj = target[ r*2 ];
+        int n    = target[ r*2 + 1 ];
+        QString str( _tl->actionLabel( subj, n ) );
+        _appendRoll( str, dice.data() + r * diceCount, diceCount, sums[r] );
+        _tl->setActionLabel( subj, n, str );
+    }
+    _tl->journal().endGroup();
+}
+
+
+/*
+  Re-roll each record of a roll log file and report any which differ.
+  The session rng then continues the stream from the end of the log.
+  Return the number of mismatched rolls or -1 if the log cannot be read.
+*/
+static int replayRolls( const char* file )
+{
+    RollLog log;
+    if( ! log.read( file ) )
+        return -1;
+
+    DiceRng rng;
+    DiceOp prog[ DICE_OP_MAX ];
+    RollBuffer buf;
+    int bad = 0;
+
+    for( size_t i = 0; i < log.size(); ++i )
+    {
+        const RollLog::Record& rec = log.record( i );
+        if( ! i || rec.seed != log.record( i - 1 ).seed ||
+            rec.offset < rng.draws )
+            diceSeed( &rng, rec.seed, DICE_SEQ );
+        diceAdvance( &rng, rec.offset - rng.draws );
+
+        int total = 0;
+        int len = compileDice( log.spec( rec ), prog );
+        buf.count = 0;
+        if( len >= 0 )
+            total = evalDiceProgram( &rng, prog, len, _emit, &buf );
+        if( len < 0 || total != rec.total ||
+            _loggedDice( buf ) != int(rec.diceCount) ||
+            memcmp( buf.value, log.dice( rec ), rec.diceCount * sizeof(int) ) )
+        {
+            fprintf( stderr, "Roll %d (%s) does not match the log\n",
+                     int(i + 1), log.spec( rec ) );
+            ++bad;
+        }
+    }
+
+    if( ! log.size() || log.record( log.size() - 1 ).seed != log.seed() )
+        diceSeed( &rng, log.seed(), DICE_SEQ );
+    _diceRng = rng;
+    _rollLog.setSeed( log.seed() );
+
+    printf( "Replayed %d rolls from %s (%d mismatched)\n",
+            int(log.size()), file, bad );
+    return bad;
+}
+
+
+/*
+  Handle the command line option at argv[i].
+  Return the index of the last argument used.
+*/
+int ActionTimeline::parseOption( int argc, char** argv, int i )
+{
+    const char* opt = argv[i];
+    const char* val = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+    if( strcmp( opt, "-snap" ) == 0 && val )
+    {
+        if( ! _snap.setFormat( val ) )
+            fprintf( stderr, "Invalid snapshot format %s\n", val );
+        return i + 1;
+    }
+    if( strcmp( opt, "-snapdir" ) == 0 && val )
+    {
+        _snap.setDirectory( QString::fromLocal8Bit( val ) );
+        return i + 1;
+    }
+    if( strcmp( opt, "-load" ) == 0 && val )
+    {
+        loadSession( QString::fromLocal8Bit( val ) );
+        return i + 1;
+    }
+    if( strcmp( opt, "-import" ) == 0 && val )
+    {
+        importLibrary( QString::fromLocal8Bit( val ) );
+        return i + 1;
+    }
+    if( strcmp( opt, "-seed" ) == 0 && val )
+    {
+        seedDice( strtoull( val, NULL, 0 ) );
+        return i + 1;
+    }
+    if( strcmp( opt, "-rolllog" ) == 0 && val )
+    {
+        if( ! _rollLog.open( val ) )
+            fprintf( stderr, "Cannot open roll log %s\n", val );
+        return i + 1;
+    }
+    if( strcmp( opt, "-undo" ) == 0 && val )
+    {
+        _tl->journal().setLimit( atoi( val ) );
+        return i + 1;
+    }
+    if( strcmp( opt, "-trace" ) == 0 && val )
+    {
+#ifdef NO_TRACE
+        fprintf( stderr, "Tracing is not compiled in\n" );
+#else
+        traceStart( val );
+#endif
+        return i + 1;
+    }
+    if( strcmp( opt, "-order" ) == 0 )
+    {
+        _tl->setAutoOrder( true );
+        return i;
+    }
+    if( strcmp( opt, "-frametime" ) == 0 )
+    {
+        _tl->showFrameTime( true );
+        return i;
+    }
+    if( strcmp( opt, "-timing" ) == 0 )
+    {
+        QTimer::singleShot( 0, this, SLOT(reportStartup()) );
+        return i;
+    }
+    if( strcmp( opt, "-replay" ) == 0 && val )
+    {
+        if( replayRolls( val ) < 0 )
+            fprintf( stderr, "Cannot read roll log %s\n", val );
+        return i + 1;
+    }
+
+    fprintf( stderr, "Invalid option %s\n", opt );
+    return i;
+}
+
 
-        cl->setText( str );
-        cl->setBase( QColor(RGB_RESOLVE) );
+static QElapsedTimer startClock;    // Started at the top of main().
+
+/*
+  Print the time from program start until the event loop is idle with
+  the window shown.
+*/
+void ActionTimeline::reportStartup()
+{
+    fprintf( stderr, "Startup %d ms", int(startClock.elapsed()) );
+    if( Timeline::tokenAtlas.ready() )
+        fprintf( stderr, " (tokens decoded in %d ms)\n",
+                 Timeline::tokenAtlas.decodeTime() );
+    else
+        fprintf( stderr, " (tokens still decoding)\n" );
+}
+
+
+/*
+  Show the odds of the current dice spec.
+*/
+void ActionTimeline::showOdds()
+{
+    QByteArray prog( diceProgram() );
+    DiceDist dist;
+
+    if( prog.isEmpty() )
+        return;
+    if( ! diceDistribution( PROG_OPS(prog), &dist ) )
+    {
+        QMessageBox::warning( this, "Dice Odds",
+                              "Too many outcomes to compute." );
+        return;
+    }
+
+    static const int pct[5] = { 10, 25, 50, 75, 90 };
+    QString str( "<h4>%1</h4>\n"
+                 "<p>Range %2 to %3<br>Mean %4, Std. Dev. %5</p>\n" );
+    str = str.arg( _dice->currentText().toHtmlEscaped() )
+             .arg( dist.min ).arg( dist.max )
+             .arg( diceMean( &dist ), 0, 'f', 2 )
+             .arg( sqrt( diceVariance( &dist ) ), 0, 'f', 2 );
+
+    str.append( "<p>Percentiles:" );
+    for( int i = 0; i < 5; ++i )
+        str.append( QString( " %1%=%2" ).arg( pct[i] )
+                        .arg( dicePercentile( &dist, pct[i] / 100.0 ) ) );
+    str.append( "</p>\n<table>\n<tr><td width=\"64\">Total</td>"
+                "<td>Chance of at least</td></tr>\n" );
+
+    // Show at most 20 rows of the cumulative distribution.
+    int step = (dist.max - dist.min + 20) / 20;
+    for( int v = dist.min; v <= dist.max; v += step )
+    {
+        str.append( QString( "<tr><td>%1</td><td>%2%</td></tr>\n" )
+                    .arg( v )
+                    .arg( diceProbAtLeast( &dist, v ) * 100.0, 0, 'f', 2 ) );
     }
+    str.append( "</table>\n" );
+    diceDistFree( &dist );
+
+    QMessageBox* box = new QMessageBox( this );
+    box->setWindowTitle( "Dice Odds" );
+    box->setTextFormat( Qt::RichText );
+    box->setText( str );
+    box->setAttribute( Qt::WA_DeleteOnClose );
+    box->show();
 }
 
 
 void ActionTimeline::rollDiceLast()
 {
-    rollDice( _tl->lastAction() );
+    rollDice( _tl->selection(), _tl->lastAction() );
 }
 
 
@@ -1050,7 +2064,11 @@ void ActionTimeline::showAbout()
         "<tr><td width=\"64\">Del</td><td>Delete last action</td>"
         "<tr><td>F2</td> <td>Rename selected character</td>"
         "<tr><td>F5</td> <td>Resolve last action</td>"
+        "<tr><td>F6</td> <td>Show odds of dice roll</td>"
         "<tr><td>CTRL+T</td> <td>Advance to next turn</td>"
+        "<tr><td>CTRL+O</td> <td>Open session</td>"
+        "<tr><td>CTRL+S</td> <td>Save session</td>"
+        "<tr><td>CTRL+I</td> <td>Import action library</td>"
         "</table>\n"
     );
 
@@ -1063,6 +2081,7 @@ void ActionTimeline::showAbout()
 }
 
 
+#ifndef TIMELINE_NO_MAIN
 #define TOKEN_COUNT 20
 static const char* tokenFile[ TOKEN_COUNT ] =
 {
@@ -1089,16 +2108,30 @@ static const char* tokenFile[ TOKEN_COUNT ] =
 };
 
 
+/*
+  Traces the dispatch of every event.  The trace arg is the QEvent type.
+*/
+class TracedApplication : public QApplication
+{
+public:
+    TracedApplication( int& argc, char** argv ) : QApplication(argc, argv) {}
+    bool notify( QObject* receiver, QEvent* ev )
+    {
+        TRACE_SCOPE_ARG( "QApplication::notify", ev->type() );
+        return QApplication::notify( receiver, ev );
+    }
+};
+
+
 int main( int argc, char** argv )
 {
-    QApplication app( argc, argv );
+    startClock.start();
+    TracedApplication app( argc, argv );
 
-#if QT_VERSION < QT_VERSION_CHECK(5, 10, 0)
-    qsrand( time(NULL) );
-#endif
+    seedDice( uint64_t(time(NULL)) ^
+              (uint64_t(QCoreApplication::applicationPid()) << 32) );
 
-    for( int i = 0; i < TOKEN_COUNT; ++i )
-        ColorLabel::tokenPixmap.push_back( new QPixmap( tokenFile[i] ) );
+    Timeline::tokenAtlas.loadAsync( tokenFile, TOKEN_COUNT );
 
     QIcon icon;
     icon.addFile( ":/icon/app-32.png", QSize(32,32) );
@@ -1106,6 +2139,8 @@ int main( int argc, char** argv )
     icon.addFile( ":/icon/app-16.png", QSize(16,16) );
     app.setWindowIcon( icon );
 
+    int status;
+    {
     ActionTimeline win;
     win.resize( 980, 350 );
     win.show();
@@ -1113,5 +2148,12 @@ int main( int argc, char** argv )
         win.parseArgs( argc-1, argv+1 );
     if( ! win.subjectCount() )
         win.newSubject();
-    return app.exec();
+    status = app.exec();
+    }
+
+    // The window destructor has joined the SnapshotWriter thread so no
+    // other thread is still recording events.
+    traceFinish();
+    return status;
 }
+#endif
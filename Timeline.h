@@ -21,97 +21,129 @@
 #include <vector>
 #include <QWidget>
 #include <QPixmap>
+#include "TimelineModel.h"
+#include "Journal.h"
+#include "Snapshot.h"
+#include "PixmapChooser.h"
 
-class ActionTable
-{
-public:
-    int defineAction( const char* aname, const char* end, int dur );
-    int actionId( const char* str ) const;
-    const char* name( int id ) const
-    {
-        return _strings.data() + _entry[ id*2 ];
-    }
-    int duration( int id ) const
-    {
-        return _entry[ id*2 + 1 ];
-    }
-    void setDuration( int id, int dur )
-    {
-        _entry[ id*2 + 1 ] = dur;
-    }
-
-private:
-    std::vector<char> _strings;
-    std::vector<int> _entry;        // Pairs of _strings index & duration.
-};
-
-class QBoxLayout;
 class QLabel;
 class QMenu;
-class QWidgetAction;
-class ColorLabel;
+class QPainter;
 class TokenMenu;
 
 class Timeline : public QWidget
 {
     Q_OBJECT
 public:
-    Timeline( const ActionTable*, QWidget* parent = NULL );
+    Timeline( const ActionTable*, TimelineModel*, QWidget* parent = NULL );
+    void modelReset();
     void addSubject( const QString& name, bool sel = true );
     int  subjectCount() const;
     void orderSubject( int dir );
+    bool autoOrder() const { return _autoOrder; }
+    void setInitiative( int subj, int value );
     bool hasSelection() const { return _subject >= 0; }
+    int  selection() const { return _subject; }
+    QRect subjectRect(int) const;
     void select(int);
     bool appendAction(int);
-    void saveImage();
+    QImage snapshot();
     void advance( int sec );
-    int  startTime() const { return _startTime; }
+    int  startTime() const { return _model->startTime(); }
     void setStartTime( int sec );
     void setTurnDuration( int sec );
-    ColorLabel* lastAction();
+    int  lastAction() const;
+    QString actionLabel( int subj, int n ) const;
+    void setActionLabel( int subj, int n, const QString& text );
+    QSize sizeHint() const;
+    Journal& journal() { return _journal; }
+    bool undo();
+    bool redo();
+    void showFrameTime( bool );
+    int  zoom() const { return _zoom; }
+    void setZoom( int level );
+
+    static PixmapAtlas tokenAtlas;
 signals:
-    void resolve(ColorLabel*);
+    void resolve(int subj, int n);
+    void resolveAll(int action);
+    void selectionChanged(int subj);
+    void autoOrderChanged(bool);
 public slots:
     void renameSubject();
     void deleteSubject(int);
     void deleteLastAction();
+    void setAutoOrder(bool);
+    void zoomIn();
+    void zoomOut();
+    void zoomReset();
 protected:
+    void paintEvent(QPaintEvent*);
+    void resizeEvent(QResizeEvent*);
+    void changeEvent(QEvent*);
     void dragEnterEvent(QDragEnterEvent*);
     void dragMoveEvent(QDragMoveEvent*);
+    void dragLeaveEvent(QDragLeaveEvent*);
     void dropEvent(QDropEvent*);
     void contextMenuEvent(QContextMenuEvent*);
     void mousePressEvent(QMouseEvent*);
     void wheelEvent(QWheelEvent*);
-    void renameItem(ColorLabel*);
+    void renameItem(int subj, int n);
     int  subjectAt(const QPoint& pnt) const;
+    bool itemAt(const QPoint& pnt, int& row, int& span) const;
 private slots:
     void recordToken(int);
     void recordTokenRem(int);
 private:
     void prepareTokenMenu(QMenu*);
-    QBoxLayout* selectedLayout();
-    ColorLabel* selectedNameLabel();
-    void makeTimeScale(int);
+    int  rowHeight(int) const;
+    int  rowTop(int) const;
+    int  timeX(float sec) const;
+    void updateRow(int);
+    void updateRows();
+    void layoutRows();
+    void restored();
+    void moveSubject(int from, int to);
+    int  reorder(int subj);
+    void sortSubjects();
+    void paint(QPainter&, const QRect& dirty);
+    void paintRow(QPainter&, int row, int y, int h, const QRect& dirty);
+    QFont scaleFont() const;
+    const QPixmap& timeScaleTile();
+    void paintTimeScale(QPainter&, const QRect& dirty);
     Timeline(const Timeline&);
 
     const ActionTable* _actions;
-    QPixmap _timeScale;
+    TimelineModel* _model;
+    Journal _journal;
+    struct ScaleTile
+    {
+        QPixmap pix;
+        int zoom;
+        int turnDur;
+    };
+    std::vector<ScaleTile> _scaleTiles;     // Time scale of recent zooms.
+    std::vector<int> _rowY;     // Row tops plus the bottom of the last row.
     TokenMenu* _tokenMenu;
     QMenu* _tokenMenuTop;
-    QLabel* _scale;
-    QBoxLayout* _lo;
-    int _pixPerSec;     // Pixels per second scale.
-    int _startTime;     // Time at left side of timeline.
+    QLabel* _frameLabel;
+    float _pixPerSec;   // Pixels per second scale.
+    int _zoom;          // Zoom level, 0 is PIX_PER_SEC.
+    int _wheelZoom;     // Ctrl+wheel angle not yet applied.
     int _turnDur;
     int _subject;       // Selected subject index.
     int _tokenItem;     // Selected _tokenMenu index.
     int _tokenRemoved;
+    int _dragAction;    // Action id being dragged over or -1.
+    bool _autoOrder;    // Keep subjects in initiative order.
 };
 
 class QComboBox;
 class QLineEdit;
-class QListWidget;
-class QListWidgetItem;
+class QListView;
+class QModelIndex;
+class QScrollArea;
+class ActionListModel;
 
 class ActionTimeline : public QWidget
 {
@@ -125,23 +157,44 @@ public slots:
     void subjectUp();
     void subjectDown();
     void turnDurationChanged(int);
-    void appendAction(QListWidgetItem*);
+    void appendAction(const QModelIndex&);
     void advance();
     void timeEdited();
-    void rollDice(ColorLabel*);
+    void undo();
+    void redo();
+    void rollDice(int subj, int n);
+    void rollDiceGroup(int action);
     void rollDiceLast();
+    void showOdds();
     void showAbout();
+    void openSession();
+    void saveSession();
+    void importLibrary();
+    void filterActions(const QString&);
+    void appendFirstAction();
+    void reportStartup();
+    void showSubject(int subj);
 private:
     void addQAction(const QKeySequence&, const QObject*, const char*);
+    bool importLibrary(const QString& file);
+    int  parseOption(int argc, char** argv, int i);
     void showTime(int sec, bool setEditField = true);
+    QByteArray diceProgram();
+    bool loadSession(const QString& file);
     ActionTimeline(const Timeline&);
 
     ActionTable _at;
+    TimelineModel _model;
+    SnapshotWriter _snap;
     Timeline* _tl;
-    QListWidget* _actList;
+    QScrollArea* _scroll;
+    QLineEdit* _actFilter;
+    QListView* _actList;
+    ActionListModel* _actModel;
     QComboBox* _turn;
     QLineEdit* _time;
     QComboBox* _dice;
+    QString _sessionFile;
 };
 
 #endif //TIMELINE_H
@@ -0,0 +1,825 @@
+/*
+  Action Timeline
+  Copyright 2020 Karl Robillard
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <string.h>
+#include <algorithm>
+#include "TimelineModel.h"
+
+
+#define INDEX_EMPTY -1
+
+static uint32_t _hashName( const char* it, const char* end )
+{
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for( ; it != end; ++it )
+        h = (h ^ uint8_t(*it)) * 16777619u;
+    return h;
+}
+
+
+/*
+  Add entry id to the _index hash table unless the name is already present.
+  The caller must ensure there is at least one free slot.
+*/
+void ActionTable::indexEntry( int id )
+{
+    const char* str = name( id );
+    size_t mask = _index.size() - 1;
+    size_t i = _hashName( str, str + strlen(str) ) & mask;
+    int e;
+
+    while( (e = _index[i]) != INDEX_EMPTY )
+    {
+        if( strcmp( name( e ), str ) == 0 )
+            return;         // Keep the first definition of a name.
+        i = (i + 1) & mask;
+    }
+    _index[i] = id;
+}
+
+
+/*
+  Rebuild the _index hash table with the given power of two size.
+*/
+void ActionTable::rehash( size_t size )
+{
+    int count = _entry.size() >> 1;
+
+    _index.assign( size, INDEX_EMPTY );
+    for( int id = 0; id < count; ++id )
+        indexEntry( id );
+}
+
+
+int ActionTable::defineAction( const char* aname, const char* end, int dur )
+{
+    int id = _entry.size() >> 1;
+
+    _entry.push_back( _strings.size() );
+    _entry.push_back( dur );
+
+    _strings.insert( _strings.end(), aname, end );
+    _strings.push_back( '\0' );
+
+    // Keep the index load factor at or below one half.
+    size_t isize = _index.size();
+    if( size_t(id + 1) * 2 > isize )
+        rehash( isize ? isize * 2 : 64 );
+    else
+        indexEntry( id );
+
+    return id;
+}
+
+
+/*
+  Return the id of an existing action or define a new one.
+  The id is stable for the lifetime of the table.
+*/
+int ActionTable::intern( const char* aname, const char* end, int dur )
+{
+    int id = actionId( aname, end );
+    if( id < 0 )
+        id = defineAction( aname, end, dur );
+    return id;
+}
+
+
+int ActionTable::actionId( const char* str ) const
+{
+    return actionId( str, str + strlen(str) );
+}
+
+
+/*
+  Return the id of the action with a name matching the characters from
+  str to end or -1 if there is no such action.
+*/
+int ActionTable::actionId( const char* str, const char* end ) const
+{
+    size_t isize = _index.size();
+    if( isize )
+    {
+        const char* ename;
+        size_t len = end - str;
+        size_t mask = isize - 1;
+        size_t i = _hashName( str, end ) & mask;
+        int id;
+
+        while( (id = _index[i]) != INDEX_EMPTY )
+        {
+            ename = name( id );
+            if( strncmp( ename, str, len ) == 0 && ename[len] == '\0' )
+                return id;
+            i = (i + 1) & mask;
+        }
+    }
+    return -1;
+}
+
+
+/*
+  Preallocate storage for count actions with names totalling stringSize
+  bytes (including terminators).
+*/
+void ActionTable::reserve( int count, size_t stringSize )
+{
+    _entry.reserve( count * 2 );
+    _strings.reserve( stringSize );
+
+    size_t isize = _index.size();
+    if( size_t(count) * 2 > isize )
+    {
+        if( ! isize )
+            isize = 64;
+        while( size_t(count) * 2 > isize )
+            isize *= 2;
+        rehash( isize );
+    }
+}
+
+
+struct InitialAction
+{
+    const char* name;
+    int dur;
+};
+
+#define ACT_COUNT   14
+static const InitialAction _initAction[ ACT_COUNT ] =
+{
+    { "Walk 10", 3 },
+    { "Run 10",  1 },
+    { "Attack",  5 },
+    { "Defend",  5 },
+    { "Shoot",   5 },
+    { "Aimed Shot", 7 },
+    { "Quick Shot", 4 },
+    { "Drink",   5 },
+    { "Draw",    1 },
+    { "Equip",   6 },
+    { "Pickup",  3 },
+    { "Throw",   3 },
+    { "Wait 1",  1 },
+    { "Wait 2",  2 }
+};
+
+/*
+  Define the built-in character actions.
+*/
+void ActionTable::defineBuiltins()
+{
+    for( int i = 0; i < ACT_COUNT; ++i )
+    {
+        const char* name = _initAction[i].name;
+        defineAction( name, name + strlen(name), _initAction[i].dur );
+    }
+}
+
+
+/*
+  Replace all actions with count entries from the flat arrays (in the
+  same layout as strings() & entries()).  The caller must ensure that the
+  entry string offsets are valid & the strings are nul terminated.
+*/
+void ActionTable::assign( const char* strings, size_t size, const int* entry,
+                          int count )
+{
+    size_t isize = 64;
+    while( size_t(count) * 2 > isize )
+        isize *= 2;
+
+    _strings.assign( strings, strings + size );
+    _entry.assign( entry, entry + count * 2 );
+    rehash( isize );
+}
+
+
+//----------------------------------------------------------------------------
+
+
+void SpanList::erase( int first, int last )
+{
+    start.erase ( start.begin()  + first, start.begin()  + last );
+    end.erase   ( end.begin()    + first, end.begin()    + last );
+    action.erase( action.begin() + first, action.begin() + last );
+    flags.erase ( flags.begin()  + first, flags.begin()  + last );
+    text.erase  ( text.begin()   + first, text.begin()   + last );
+
+    if( head > first )
+        head = (head > last) ? head - (last - first) : first;
+}
+
+
+/*
+  Insert copies of the spans from first to last of src at index pos.
+*/
+void SpanList::insert( int pos, const SpanList& src, int first, int last )
+{
+    start.insert ( start.begin()  + pos, src.start.begin()  + first,
+                                         src.start.begin()  + last );
+    end.insert   ( end.begin()    + pos, src.end.begin()    + first,
+                                         src.end.begin()    + last );
+    action.insert( action.begin() + pos, src.action.begin() + first,
+                                         src.action.begin() + last );
+    flags.insert ( flags.begin()  + pos, src.flags.begin()  + first,
+                                         src.flags.begin()  + last );
+    text.insert  ( text.begin()   + pos, src.text.begin()   + first,
+                                         src.text.begin()   + last );
+
+    if( head > pos )
+        head += last - first;
+}
+
+
+/*
+  Move all spans from index first onward by sec seconds.
+*/
+void SpanList::shift( int first, float sec )
+{
+    int count = size();
+    for( int n = first; n < count; ++n )
+    {
+        start[n] += sec;
+        end[n]   += sec;
+    }
+}
+
+
+TokenSet::TokenSet( const TokenSet& other ) : _count(0), _cap(TOKEN_INLINE)
+{
+    *this = other;
+}
+
+
+TokenSet& TokenSet::operator=( const TokenSet& other )
+{
+    if( this != &other )
+    {
+        _count = 0;
+        reserve( other._count );
+        _count = other._count;
+        memcpy( durPtr(), other.durPtr(), _count * sizeof(uint16_t) );
+        memcpy( idPtr(), other.idPtr(), _count );
+    }
+    return *this;
+}
+
+
+/*
+  Ensure there is room for at least cap tokens.
+*/
+void TokenSet::reserve( int cap )
+{
+    if( cap <= _cap )
+        return;
+    if( cap < _cap * 2 )
+        cap = _cap * 2;
+    if( cap > 0xffff )
+        cap = 0xffff;
+
+    uint16_t* mem = (uint16_t*) malloc( cap * 3 );
+    uint8_t* id = (uint8_t*) (mem + cap);
+    memcpy( mem, durPtr(), _count * sizeof(uint16_t) );
+    memcpy( id, idPtr(), _count );
+
+    if( _cap > TOKEN_INLINE )
+        free( _buf.heap );
+    _buf.heap = mem;
+    _cap = cap;
+}
+
+
+/*
+  Add a token which lasts dur seconds (or TOKEN_FOREVER).
+*/
+void TokenSet::append( int id, int dur )
+{
+    if( _count == 0xffff )
+        return;
+    reserve( _count + 1 );
+    if( dur < 0 )
+        dur = TOKEN_FOREVER;
+    else if( dur > 0xffff )
+        dur = 0xffff;
+    durPtr()[ _count ] = dur;
+    idPtr()[ _count ] = id;
+    ++_count;
+}
+
+
+void TokenSet::remove( int index )
+{
+    if( index < 0 || index >= _count )
+        return;
+    uint16_t* dur = durPtr();
+    uint8_t* id = idPtr();
+    --_count;
+    memmove( dur + index, dur + index + 1,
+             (_count - index) * sizeof(uint16_t) );
+    memmove( id + index, id + index + 1, _count - index );
+}
+
+
+/*
+  Return true if any token has a duration.
+*/
+bool TokenSet::timed() const
+{
+    const uint16_t* dur = durPtr();
+    for( int n = 0; n < _count; ++n )
+    {
+        if( dur[n] != TOKEN_FOREVER )
+            return true;
+    }
+    return false;
+}
+
+
+/*
+  Subtract sec from all token durations and remove those which expire.
+  Return the number of tokens removed.
+*/
+int TokenSet::tick( int sec )
+{
+    uint16_t* dur = durPtr();
+    uint8_t* id = idPtr();
+    int n, keep = 0;
+
+    for( n = 0; n < _count; ++n )
+    {
+        if( dur[n] != TOKEN_FOREVER )
+        {
+            if( dur[n] <= sec )
+                continue;
+            dur[keep] = dur[n] - sec;
+        }
+        else
+            dur[keep] = TOKEN_FOREVER;
+        id[keep++] = id[n];
+    }
+    n = _count - keep;
+    _count = keep;
+    return n;
+}
+
+
+//----------------------------------------------------------------------------
+
+
+void SpanList::swap( SpanList& other )
+{
+    start.swap ( other.start );
+    end.swap   ( other.end );
+    action.swap( other.action );
+    flags.swap ( other.flags );
+    text.swap  ( other.text );
+    std::swap( head, other.head );
+}
+
+
+int TimelineModel::addSubject( const std::string& name )
+{
+    _name.push_back( name );
+    _init.push_back( 0 );
+    _tokens.push_back( TokenSet() );
+    _spans.push_back( SpanList() );
+    return _name.size() - 1;
+}
+
+
+/*
+  Remove all subjects & set the start time.
+*/
+void TimelineModel::clear( int startTime )
+{
+    _name.clear();
+    _init.clear();
+    _tokens.clear();
+    _spans.clear();
+    _startTime = startTime;
+}
+
+
+void TimelineModel::removeSubject( int i )
+{
+    _name.erase( _name.begin() + i );
+    _init.erase( _init.begin() + i );
+    _tokens.erase( _tokens.begin() + i );
+    _spans.erase( _spans.begin() + i );
+}
+
+
+/*
+  Insert a subject at index i, taking the contents of the arguments.
+*/
+void TimelineModel::insertSubject( int i, std::string& name, int init,
+                                   TokenSet& tokens, SpanList& spans )
+{
+    _name.insert( _name.begin() + i, std::string() );
+    _init.insert( _init.begin() + i, init );
+    _tokens.insert( _tokens.begin() + i, tokens );
+    _spans.insert( _spans.begin() + i, SpanList() );
+    _name[i].swap( name );
+    _spans[i].swap( spans );
+}
+
+
+/*
+  Remove subject i, moving its contents to the arguments.
+*/
+void TimelineModel::takeSubject( int i, std::string& name, int& init,
+                                 TokenSet& tokens, SpanList& spans )
+{
+    _name[i].swap( name );
+    init = _init[i];
+    tokens = _tokens[i];
+    _spans[i].swap( spans );
+    removeSubject( i );
+}
+
+
+template<typename T>
+static void _moveElement( std::vector<T>& vec, int from, int to )
+{
+    typename std::vector<T>::iterator it = vec.begin();
+    if( from < to )
+        std::rotate( it + from, it + from + 1, it + to + 1 );
+    else
+        std::rotate( it + to, it + from, it + from + 1 );
+}
+
+
+void TimelineModel::moveSubject( int from, int to )
+{
+    if( from != to )
+    {
+        _moveElement( _name,   from, to );
+        _moveElement( _init,   from, to );
+        _moveElement( _tokens, from, to );
+        _moveElement( _spans,  from, to );
+    }
+}
+
+
+/*
+  Return true if subject a comes before b in initiative order.  Subjects
+  are ordered by the time their current action completes, with ties going
+  to the higher initiative.  Subjects with no actions queued are last.
+*/
+bool TimelineModel::orderedBefore( int a, int b ) const
+{
+    const SpanList& sa = _spans[a];
+    const SpanList& sb = _spans[b];
+    if( sa.empty() || sb.empty() )
+    {
+        if( sa.empty() != sb.empty() )
+            return sb.empty();
+    }
+    else
+    {
+        float ea = sa.end[ sa.head ];
+        float eb = sb.end[ sb.head ];
+        if( ea != eb )
+            return ea < eb;
+    }
+    return _init[a] > _init[b];
+}
+
+
+/*
+  Return the index before i to which subject i should be moved to be in
+  initiative order, or i if it need not move earlier.  The subjects
+  before i must be in order.
+*/
+int TimelineModel::earlierIndex( int i ) const
+{
+    if( i < 1 || ! orderedBefore( i, i - 1 ) )
+        return i;
+
+    // Find the first subject which i comes before.
+    int lo = 0;
+    int hi = i - 1;
+    while( lo < hi )
+    {
+        int mid = (lo + hi) / 2;
+        if( orderedBefore( i, mid ) )
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+
+/*
+  Return the index after i to which subject i should be moved to be in
+  initiative order, or i if it need not move later.  The subjects after
+  i must be in order.
+*/
+int TimelineModel::laterIndex( int i ) const
+{
+    int last = subjectCount() - 1;
+    if( i >= last || ! orderedBefore( i + 1, i ) )
+        return i;
+
+    // Find the last subject which comes before i.
+    int lo = i + 1;
+    int hi = last;
+    while( lo < hi )
+    {
+        int mid = (lo + hi + 1) / 2;
+        if( orderedBefore( mid, i ) )
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+
+/*
+  Return the index to which subject i should be moved after its current
+  action has changed.  All other subjects must be in initiative order.
+*/
+int TimelineModel::orderedIndex( int i ) const
+{
+    int n = earlierIndex( i );
+    return (n == i) ? laterIndex( i ) : n;
+}
+
+
+/*
+  Return true if all subjects are in initiative order.
+*/
+bool TimelineModel::inOrder() const
+{
+    int count = subjectCount();
+    for( int i = 1; i < count; ++i )
+    {
+        if( orderedBefore( i, i - 1 ) )
+            return false;
+    }
+    return true;
+}
+
+
+void TimelineModel::addToken( int i, int token, int dur )
+{
+    _tokens[i].append( token, dur );
+}
+
+
+void TimelineModel::removeToken( int i, int index )
+{
+    _tokens[i].remove( index );
+}
+
+
+/*
+  Return the index of the last action of subject i or -1 if it has none.
+*/
+int TimelineModel::lastAction( int i ) const
+{
+    const SpanList& sl = _spans[i];
+    return sl.empty() ? -1 : sl.size() - 1;
+}
+
+
+/*
+  Return the time at which appendAction() would start a new action.
+*/
+float TimelineModel::appendTime( int i ) const
+{
+    const SpanList& sl = _spans[i];
+    float t = float(_startTime);
+    if( ! sl.empty() && sl.end.back() > t )
+        t = sl.end.back();
+    return t;
+}
+
+
+/*
+  Queue an action to begin when the last one for the subject ends.
+*/
+void TimelineModel::appendAction( int i, int actionId, float dur )
+{
+    SpanList& sl = _spans[i];
+    float t = appendTime( i );
+
+    sl.start.push_back( t );
+    sl.end.push_back( t + dur );
+    sl.action.push_back( actionId );
+    sl.flags.push_back( 0 );
+    sl.text.push_back( std::string() );
+}
+
+
+/*
+  Remove an action.  Any following actions are moved earlier to fill the
+  gap.
+*/
+void TimelineModel::removeAction( int i, int n )
+{
+    SpanList& sl = _spans[i];
+    float gap = duration( i, n );
+    sl.erase( n, n + 1 );
+    sl.shift( n, -gap );
+}
+
+
+/*
+  Remove action n of subject i, moving it to dst.  Any following actions
+  are moved earlier to fill the gap.
+*/
+void TimelineModel::takeSpan( int i, int n, SpanList& dst )
+{
+    dst = SpanList();
+    dst.insert( 0, _spans[i], n, n + 1 );
+    removeAction( i, n );
+}
+
+
+/*
+  Insert the first span of src as action n of subject i.  Any following
+  actions are moved later by its duration.  Src is emptied.
+*/
+void TimelineModel::putSpan( int i, int n, SpanList& src )
+{
+    SpanList& sl = _spans[i];
+    sl.insert( n, src, 0, 1 );
+    sl.shift( n + 1, duration( i, n ) );
+    src = SpanList();
+}
+
+
+/*
+  Return the start of an action, clipped to the model start time.
+*/
+float TimelineModel::visibleStart( int i, int n ) const
+{
+    float t = _spans[i].start[n];
+    return (t < float(_startTime)) ? float(_startTime) : t;
+}
+
+
+/*
+  Return the remaining (visible) duration of an action.
+*/
+float TimelineModel::duration( int i, int n ) const
+{
+    return _spans[i].end[n] - visibleStart( i, n );
+}
+
+
+/*
+  Change the remaining duration of an action.  Any following actions are
+  moved to keep them contiguous.
+*/
+void TimelineModel::setDuration( int i, int n, float dur )
+{
+    SpanList& sl = _spans[i];
+    float delta = visibleStart( i, n ) + dur - sl.end[n];
+    sl.end[n] += delta;
+    sl.shift( n + 1, delta );
+}
+
+
+void TimelineModel::setLabel( int i, int n, const std::string& text,
+                              int flags )
+{
+    SpanList& sl = _spans[i];
+    sl.text[n]  = text;
+    sl.flags[n] = flags;
+}
+
+
+/*
+  Replace the spans of subject i with count spans from the column arrays.
+  All labels are reset to the action names.
+*/
+void TimelineModel::assignSpans( int i, int count, const float* start,
+                                 const float* end, const int* action,
+                                 const uint8_t* flags )
+{
+    SpanList& sl = _spans[i];
+    sl.start.assign( start, start + count );
+    sl.end.assign( end, end + count );
+    sl.action.assign( action, action + count );
+    sl.flags.assign( flags, flags + count );
+    sl.text.clear();
+    sl.text.resize( count );
+    sl.head = 0;
+}
+
+
+/*
+  Set the time at the left side of the timeline.  The queued actions are
+  moved along with it so they keep their place relative to the start.
+*/
+void TimelineModel::setStartTime( int sec )
+{
+    float delta = float(sec - _startTime);
+    std::vector<SpanList>::iterator it;
+    for( it = _spans.begin(); it != _spans.end(); ++it )
+        it->shift( 0, delta );
+    _startTime = sec;
+}
+
+
+#define TRIM_MIN    32
+
+/*
+  Return true if advance( sec ) would modify the spans or tokens of
+  subject i.
+*/
+bool TimelineModel::advanceChanges( int i, int sec ) const
+{
+    const SpanList& sl = _spans[i];
+    if( ! sl.empty() && sl.end[ sl.head ] <= float(_startTime + sec) )
+        return true;
+    return _tokens[i].timed();
+}
+
+
+/*
+  Return the SpanList::head of subject i after advance( sec ).  Trim is
+  set to true if advance will then erase all the spans before the head.
+*/
+int TimelineModel::advanceHead( int i, int sec, bool& trim ) const
+{
+    const SpanList& sl = _spans[i];
+    float t = float(_startTime + sec);
+    int count = sl.size();
+    int head = sl.head;
+    while( head < count && sl.end[ head ] <= t )
+        ++head;
+    trim = (head >= TRIM_MIN && head * 2 >= count);
+    return head;
+}
+
+
+/*
+  Undo advance() for subject i.  If advance() erased spans, count spans
+  from index first of erased are put back before the remaining ones.
+*/
+void TimelineModel::rewindSpans( int i, int head, const SpanList& erased,
+                                 int first, int count )
+{
+    SpanList& sl = _spans[i];
+    if( count )
+        sl.insert( 0, erased, first, first + count );
+    sl.head = head;
+}
+
+
+/*
+  Move the start time forward.  Actions which end before the new start
+  time are skipped by moving the row head index; the arrays are only
+  compacted once enough dead spans have accumulated.
+
+  Token durations are reduced by sec and expired tokens removed.  Return
+  true if any tokens expired.
+*/
+bool TimelineModel::advance( int sec )
+{
+    if( sec < 1 )
+        return false;
+
+    int count = subjectCount();
+    bool trim;
+    for( int i = 0; i < count; ++i )
+    {
+        SpanList& sl = _spans[i];
+        sl.head = advanceHead( i, sec, trim );
+        if( trim )
+            sl.erase( 0, sl.head );
+    }
+    _startTime += sec;
+
+    int expired = 0;
+    std::vector<TokenSet>::iterator tt;
+    for( tt = _tokens.begin(); tt != _tokens.end(); ++tt )
+    {
+        if( tt->count() )
+            expired += tt->tick( sec );
+    }
+    return expired > 0;
+}
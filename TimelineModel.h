@@ -0,0 +1,199 @@
+#ifndef TIMELINEMODEL_H
+#define TIMELINEMODEL_H
+/*
+  Action Timeline
+  Copyright 2020 Karl Robillard
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+class ActionTable
+{
+public:
+    int defineAction( const char* aname, const char* end, int dur );
+    int intern( const char* aname, const char* end, int dur );
+    int actionId( const char* str ) const;
+    int actionId( const char* str, const char* end ) const;
+    int count() const { return _entry.size() >> 1; }
+    const char* name( int id ) const
+    {
+        return _strings.data() + _entry[ id*2 ];
+    }
+    int duration( int id ) const
+    {
+        return _entry[ id*2 + 1 ];
+    }
+    void setDuration( int id, int dur )
+    {
+        _entry[ id*2 + 1 ] = dur;
+    }
+    const std::vector<char>& strings() const { return _strings; }
+    const std::vector<int>& entries() const { return _entry; }
+    void assign( const char* strings, size_t size, const int* entry,
+                 int count );
+    void reserve( int count, size_t stringSize );
+    void defineBuiltins();
+
+private:
+    void indexEntry( int id );
+    void rehash( size_t size );
+
+    std::vector<char> _strings;
+    std::vector<int> _entry;        // Pairs of _strings index & duration.
+    std::vector<int> _index;        // Open addressing hash of entry ids.
+};
+
+#define TOKEN_INLINE    6
+#define TOKEN_FOREVER   0       // Duration of tokens which never expire.
+
+/*
+  Tokens (conditions) held by a subject as parallel id & duration arrays.
+  Up to TOKEN_INLINE tokens are stored in the object itself; beyond that
+  the arrays are moved to a single heap block.  Durations are in seconds.
+*/
+class TokenSet
+{
+public:
+    TokenSet() : _count(0), _cap(TOKEN_INLINE) {}
+    TokenSet( const TokenSet& );
+    ~TokenSet() { if( _cap > TOKEN_INLINE ) free( _buf.heap ); }
+    TokenSet& operator=( const TokenSet& );
+
+    int  count() const { return _count; }
+    bool timed() const;
+    const uint8_t* ids() const { return idPtr(); }
+    const uint16_t* durations() const { return durPtr(); }
+    void append( int id, int dur );
+    void remove( int index );
+    void clear() { _count = 0; }
+    int  tick( int sec );
+
+private:
+    uint16_t* durPtr() const
+        { return (_cap > TOKEN_INLINE) ? _buf.heap : (uint16_t*) _buf.local; }
+    uint8_t* idPtr() const
+        { return (uint8_t*) (durPtr() + _cap); }
+    void reserve( int cap );
+
+    union
+    {
+        uint16_t* heap;         // Durations followed by ids.
+        uint16_t  local[ TOKEN_INLINE + TOKEN_INLINE / 2 ];
+    } _buf;
+    uint16_t _count;
+    uint16_t _cap;
+};
+
+/*
+  Actions queued for a single subject, held as parallel arrays sorted by
+  time.  Spans before head have ended and are trimmed lazily.
+*/
+struct SpanList
+{
+    enum Flags
+    {
+        RESOLVED = 1
+    };
+
+    SpanList() : head(0) {}
+    int  size() const { return int(action.size()); }
+    bool empty() const { return head == size(); }
+    void erase( int first, int last );
+    void insert( int pos, const SpanList& src, int first, int last );
+    void shift( int first, float sec );
+    void swap( SpanList& );
+
+    std::vector<float>   start;         // Absolute seconds.
+    std::vector<float>   end;
+    std::vector<int>     action;        // ActionTable id.
+    std::vector<uint8_t> flags;
+    std::vector<std::string> text;      // Label; empty uses the action name.
+    int head;                           // First span ending after start time.
+};
+
+/*
+  Timeline state for all subjects.  Each subject is an index into the
+  _name, _init, _tokens & _spans arrays.
+*/
+class TimelineModel
+{
+public:
+    TimelineModel() : _startTime(0) {}
+
+    int  subjectCount() const { return int(_name.size()); }
+    int  addSubject( const std::string& name );
+    void removeSubject( int i );
+    void moveSubject( int from, int to );
+    const std::string& subjectName( int i ) const { return _name[i]; }
+    void setSubjectName( int i, const std::string& name ) { _name[i] = name; }
+    int  initiative( int i ) const { return _init[i]; }
+    void setInitiative( int i, int value ) { _init[i] = value; }
+
+    bool orderedBefore( int a, int b ) const;
+    int  earlierIndex( int i ) const;
+    int  laterIndex( int i ) const;
+    int  orderedIndex( int i ) const;
+    bool inOrder() const;
+
+    const TokenSet& tokens( int i ) const { return _tokens[i]; }
+    void addToken( int i, int token, int dur = TOKEN_FOREVER );
+    void removeToken( int i, int index );
+
+    const SpanList& spans( int i ) const { return _spans[i]; }
+    int  lastAction( int i ) const;
+    float appendTime( int i ) const;
+    void appendAction( int i, int actionId, float dur );
+    void removeAction( int i, int n );
+    float visibleStart( int i, int n ) const;
+    float duration( int i, int n ) const;
+    void setDuration( int i, int n, float dur );
+    void setLabel( int i, int n, const std::string& text, int flags );
+    void assignSpans( int i, int count, const float* start,
+                      const float* end, const int* action,
+                      const uint8_t* flags );
+    void setTokens( int i, const TokenSet& ts ) { _tokens[i] = ts; }
+
+    void clear( int startTime = 0 );
+    int  startTime() const { return _startTime; }
+    void setStartTime( int sec );
+    bool advance( int sec );
+    bool advanceChanges( int i, int sec ) const;
+
+    // Used by Journal to restore earlier states.
+    void insertSubject( int i, std::string& name, int init, TokenSet&,
+                        SpanList& );
+    void takeSubject( int i, std::string& name, int& init, TokenSet&,
+                      SpanList& );
+    void swapStartTime( int& sec ) { std::swap( _startTime, sec ); }
+    void takeSpan( int i, int n, SpanList& dst );
+    void putSpan( int i, int n, SpanList& src );
+    int  advanceHead( int i, int sec, bool& trim ) const;
+    void rewindSpans( int i, int head, const SpanList& erased, int first,
+                      int count );
+
+private:
+    std::vector<std::string> _name;
+    std::vector<int>         _init;     // Initiative stat to break ties.
+    std::vector<TokenSet>    _tokens;
+    std::vector<SpanList>    _spans;
+    int _startTime;             // Time at left side of timeline.
+};
+
+#endif //TIMELINEMODEL_H
@@ -0,0 +1,163 @@
+/*
+  Action Timeline
+  Copyright 2020 Karl Robillard
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Trace.h"
+
+#define TRACE_RING_SIZE     65536   // Events kept per thread.
+
+struct TraceEvent
+{
+    const char* name;
+    uint64_t start;         // Nanoseconds.
+    uint64_t end;
+    int arg;
+};
+
+/*
+  Buffers are allocated when a thread first records an event and are kept
+  for the life of the process.
+*/
+struct TraceBuffer
+{
+    std::vector<TraceEvent> event;
+    size_t next;
+    bool wrapped;
+    int tid;
+};
+
+std::atomic<bool> traceEnabled( false );
+static std::string _traceFile;
+static std::mutex _traceMutex;
+static std::vector<TraceBuffer*> _traceBuffers;
+static thread_local TraceBuffer* _threadBuffer = NULL;
+static uint64_t _traceEpoch;
+
+
+/*
+  Enable tracing.  The events are written to file by traceFinish().
+*/
+void traceStart( const char* file )
+{
+    _traceFile = file;
+    _traceEpoch = traceNow() - 1;
+    traceEnabled.store( true, std::memory_order_release );
+}
+
+
+/*
+  Return the current time in nanoseconds.  This is never zero.
+*/
+uint64_t traceNow()
+{
+    using namespace std::chrono;
+    return uint64_t( duration_cast<nanoseconds>(
+                        steady_clock::now().time_since_epoch() ).count() );
+}
+
+
+static TraceBuffer* _registerThread()
+{
+    TraceBuffer* buf = new TraceBuffer;
+    buf->event.resize( TRACE_RING_SIZE );
+    buf->next = 0;
+    buf->wrapped = false;
+
+    std::lock_guard<std::mutex> lock( _traceMutex );
+    buf->tid = int(_traceBuffers.size()) + 1;
+    _traceBuffers.push_back( buf );
+    return buf;
+}
+
+
+void traceRecord( const char* name, uint64_t start, uint64_t end, int arg )
+{
+    TraceBuffer* buf = _threadBuffer;
+    if( ! buf )
+        buf = _threadBuffer = _registerThread();
+
+    TraceEvent& ev = buf->event[ buf->next ];
+    ev.name  = name;
+    ev.start = start;
+    ev.end   = end;
+    ev.arg   = arg;
+    if( ++buf->next == TRACE_RING_SIZE )
+    {
+        buf->next = 0;
+        buf->wrapped = true;
+    }
+}
+
+
+static void _writeEvent( FILE* fp, const TraceEvent& ev, int tid,
+                         uint64_t epoch, bool& first )
+{
+    // Chrome trace times are in microseconds.
+    fprintf( fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                 "\"ts\":%.3f,\"dur\":%.3f",
+             first ? "" : ",\n", ev.name, tid,
+             (ev.start - epoch) / 1000.0, (ev.end - ev.start) / 1000.0 );
+    if( ev.arg >= 0 )
+        fprintf( fp, ",\"args\":{\"arg\":%d}", ev.arg );
+    fputc( '}', fp );
+    first = false;
+}
+
+
+/*
+  Stop tracing and write all recorded events.  Return false if tracing
+  was not enabled or the file cannot be written.
+*/
+bool traceFinish()
+{
+    if( ! traceEnabled.exchange( false ) )
+        return false;
+
+    FILE* fp = fopen( _traceFile.c_str(), "w" );
+    if( ! fp )
+    {
+        fprintf( stderr, "Cannot write trace %s\n", _traceFile.c_str() );
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock( _traceMutex );
+    bool first = true;
+    size_t i, count;
+
+    fprintf( fp, "{\"traceEvents\":[\n" );
+    for( size_t b = 0; b < _traceBuffers.size(); ++b )
+    {
+        const TraceBuffer* buf = _traceBuffers[b];
+        if( buf->wrapped )
+        {
+            for( i = buf->next; i < TRACE_RING_SIZE; ++i )
+                _writeEvent( fp, buf->event[i], buf->tid, _traceEpoch,
+                             first );
+        }
+        count = buf->next;
+        for( i = 0; i < count; ++i )
+            _writeEvent( fp, buf->event[i], buf->tid, _traceEpoch, first );
+    }
+    fprintf( fp, "\n],\"displayTimeUnit\":\"ms\"}\n" );
+    return fclose( fp ) == 0;
+}
@@ -0,0 +1,72 @@
+#ifndef TRACE_H
+#define TRACE_H
+/*
+  Action Timeline
+  Copyright 2020 Karl Robillard
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <atomic>
+
+/*
+  Scoped timers for finding stalls.  While tracing is enabled each thread
+  records events into its own ring buffer (the oldest are overwritten) and
+  traceFinish() writes them as a Chrome trace JSON file, which can be
+  viewed with chrome://tracing or https://ui.perfetto.dev.
+
+  Define NO_TRACE to compile out all the instrumentation.
+*/
+
+#ifdef NO_TRACE
+#define TRACE_SCOPE(name)
+#define TRACE_SCOPE_ARG(name,arg)
+#else
+#define TRACE_SCOPE(name)           TraceScope _traceScope(name, -1)
+#define TRACE_SCOPE_ARG(name,arg)   TraceScope _traceScope(name, arg)
+#endif
+
+extern std::atomic<bool> traceEnabled;
+
+void     traceStart( const char* file );
+bool     traceFinish();
+uint64_t traceNow();
+void     traceRecord( const char* name, uint64_t start, uint64_t end,
+                      int arg );
+
+/*
+  Records an event from construction to destruction.  The name must be a
+  string literal (only the pointer is kept).
+*/
+class TraceScope
+{
+public:
+    TraceScope( const char* name, int arg )
+        : _name(name), _arg(arg),
+          _start(traceEnabled.load( std::memory_order_acquire ) ?
+                 traceNow() : 0) {}
+    ~TraceScope()
+    {
+        if( _start )
+            traceRecord( _name, _start, traceNow(), _arg );
+    }
+
+private:
+    const char* _name;
+    int _arg;
+    uint64_t _start;
+};
+
+#endif //TRACE_H
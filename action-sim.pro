@@ -0,0 +1,8 @@
+OBJECTS_DIR = obj-sim
+
+CONFIG -= qt
+CONFIG += console
+
+TARGET = action-sim
+HEADERS += TimelineModel.h
+SOURCES += Simulate.cpp TimelineModel.cpp
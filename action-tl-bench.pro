@@ -0,0 +1,12 @@
+OBJECTS_DIR = obj-bench
+MOC_DIR = moc-bench
+
+QT += widgets
+RESOURCES += icons.qrc
+
+CONFIG += qt console
+DEFINES += TIMELINE_NO_MAIN
+
+TARGET = action-tl-bench
+HEADERS += Timeline.h TimelineModel.h PixmapChooser.h Snapshot.h RollLog.h Session.h ActionList.h Journal.h Trace.h
+SOURCES += Bench.cpp Timeline.cpp TimelineModel.cpp PixmapChooser.cpp Snapshot.cpp RollLog.cpp Session.cpp ActionList.cpp Journal.cpp Trace.cpp
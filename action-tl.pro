@@ -7,5 +7,5 @@ RESOURCES += icons.qrc
 CONFIG += qt
 #CONFIG += debug
 
-HEADERS += Timeline.h PixmapChooser.h
-SOURCES += Timeline.cpp PixmapChooser.cpp
+HEADERS += Timeline.h TimelineModel.h PixmapChooser.h Snapshot.h RollLog.h Session.h ActionList.h Journal.h Trace.h
+SOURCES += Timeline.cpp TimelineModel.cpp PixmapChooser.cpp Snapshot.cpp RollLog.cpp Session.cpp ActionList.cpp Journal.cpp Trace.cpp
@@ -0,0 +1,543 @@
+/*
+  diceDist.c
+  Copyright 2020 Karl Robillard
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+/*
+  Exact outcome distribution of compiled dice specs.
+  User must #include this file after evalDice.c.  As there, the public
+  functions are static inline to avoid unused function warnings.
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI    3.14159265358979323846
+#endif
+
+typedef struct
+{
+    double* prob;       /* Probability of each total from min to max. */
+    int min;
+    int max;
+}
+DiceDist;
+
+#define DIST_LIMIT      (1 << 22)   /* Maximum number of outcomes. */
+#define DIST_FFT_MIN    (1 << 14)   /* Use FFT above this many products. */
+
+
+static inline void diceDistFree( DiceDist* dist )
+{
+    free( dist->prob );
+    dist->prob = NULL;
+}
+
+
+/*
+ * In-place iterative radix-2 FFT of n (a power of two) complex values.
+ */
+static void _fft( double* re, double* im, int n, int inverse )
+{
+    int i, j, k, len;
+    double t;
+
+    for( i = 1, j = 0; i < n; ++i )
+    {
+        int bit = n >> 1;
+        for( ; j & bit; bit >>= 1 )
+            j ^= bit;
+        j ^= bit;
+        if( i < j )
+        {
+            t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+
+    for( len = 2; len <= n; len <<= 1 )
+    {
+        double ang = 2.0 * M_PI / len * (inverse ? 1.0 : -1.0);
+        double wr = cos( ang );
+        double wi = sin( ang );
+        int half = len >> 1;
+        for( i = 0; i < n; i += len )
+        {
+            double cr = 1.0, ci = 0.0;
+            for( k = 0; k < half; ++k )
+            {
+                int a = i + k;
+                int b = a + half;
+                double xr = re[b] * cr - im[b] * ci;
+                double xi = re[b] * ci + im[b] * cr;
+                re[b] = re[a] - xr;
+                im[b] = im[a] - xi;
+                re[a] += xr;
+                im[a] += xi;
+                t  = cr * wr - ci * wi;
+                ci = cr * wi + ci * wr;
+                cr = t;
+            }
+        }
+    }
+
+    if( inverse )
+    {
+        for( i = 0; i < n; ++i )
+        {
+            re[i] /= n;
+            im[i] /= n;
+        }
+    }
+}
+
+
+/*
+ * Convolve arrays a (length la) and b (length lb) into out, which must hold
+ * la + lb - 1 values.  Return zero if memory could not be allocated.
+ */
+static int _convolve( const double* a, int la, const double* b, int lb,
+                      double* out )
+{
+    int lo = la + lb - 1;
+    int i, j;
+
+    if( (double) la * lb < DIST_FFT_MIN )
+    {
+        for( i = 0; i < lo; ++i )
+            out[i] = 0.0;
+        for( i = 0; i < la; ++i )
+            for( j = 0; j < lb; ++j )
+                out[i + j] += a[i] * b[j];
+    }
+    else
+    {
+        double* buf;
+        double *ar, *ai, *br, *bi;
+        int n = 1;
+        while( n < lo )
+            n <<= 1;
+
+        buf = (double*) calloc( 4 * n, sizeof(double) );
+        if( ! buf )
+            return 0;
+        ar = buf;
+        ai = ar + n;
+        br = ai + n;
+        bi = br + n;
+
+        for( i = 0; i < la; ++i )
+            ar[i] = a[i];
+        for( i = 0; i < lb; ++i )
+            br[i] = b[i];
+
+        _fft( ar, ai, n, 0 );
+        _fft( br, bi, n, 0 );
+        for( i = 0; i < n; ++i )
+        {
+            double t = ar[i] * br[i] - ai[i] * bi[i];
+            ai[i]    = ar[i] * bi[i] + ai[i] * br[i];
+            ar[i]    = t;
+        }
+        _fft( ar, ai, n, 1 );
+
+        for( i = 0; i < lo; ++i )
+            out[i] = (ar[i] > 0.0) ? ar[i] : 0.0;   /* Drop rounding noise. */
+        free( buf );
+    }
+    return 1;
+}
+
+
+/*
+ * Replace dist with the convolution of dist and src.
+ */
+static int _distAdd( DiceDist* dist, const DiceDist* src )
+{
+    int la = dist->max - dist->min + 1;
+    int lb = src->max - src->min + 1;
+    double* out;
+
+    if( la + lb - 1 > DIST_LIMIT )
+        return 0;
+    out = (double*) malloc( (la + lb - 1) * sizeof(double) );
+    if( ! out )
+        return 0;
+    if( ! _convolve( dist->prob, la, src->prob, lb, out ) )
+    {
+        free( out );
+        return 0;
+    }
+
+    free( dist->prob );
+    dist->prob = out;
+    dist->min += src->min;
+    dist->max += src->max;
+    return 1;
+}
+
+
+static int _distConst( DiceDist* dist, int value )
+{
+    dist->prob = (double*) malloc( sizeof(double) );
+    if( ! dist->prob )
+        return 0;
+    dist->prob[0] = 1.0;
+    dist->min = dist->max = value;
+    return 1;
+}
+
+
+static void _distNegate( DiceDist* dist )
+{
+    int len = dist->max - dist->min + 1;
+    int i;
+    for( i = 0; i < len / 2; ++i )
+    {
+        double tmp = dist->prob[i];
+        dist->prob[i] = dist->prob[len - 1 - i];
+        dist->prob[len - 1 - i] = tmp;
+    }
+    i = dist->min;
+    dist->min = -dist->max;
+    dist->max = -i;
+}
+
+
+/*
+ * Replace dist with the distribution of the product of dist and src.
+ */
+static int _distMul( DiceDist* dist, const DiceDist* src )
+{
+    double* out;
+    int64_t c[4];
+    int64_t lo, hi;
+    int a, b, i;
+
+    c[0] = (int64_t) dist->min * src->min;
+    c[1] = (int64_t) dist->min * src->max;
+    c[2] = (int64_t) dist->max * src->min;
+    c[3] = (int64_t) dist->max * src->max;
+    lo = hi = c[0];
+    for( i = 1; i < 4; ++i )
+    {
+        if( c[i] < lo ) lo = c[i];
+        if( c[i] > hi ) hi = c[i];
+    }
+    if( lo < INT32_MIN || hi > INT32_MAX || hi - lo + 1 > DIST_LIMIT )
+        return 0;
+
+    out = (double*) calloc( hi - lo + 1, sizeof(double) );
+    if( ! out )
+        return 0;
+    for( a = dist->min; a <= dist->max; ++a )
+    {
+        double pa = dist->prob[ a - dist->min ];
+        if( pa == 0.0 )
+            continue;
+        for( b = src->min; b <= src->max; ++b )
+            out[ a * b - lo ] += pa * src->prob[ b - src->min ];
+    }
+
+    free( dist->prob );
+    dist->prob = out;
+    dist->min = (int) lo;
+    dist->max = (int) hi;
+    return 1;
+}
+
+
+/*
+ * Set dist to the values of a single die of a DICE_OP_ROLL, including any
+ * rerolls and explosions (with the same limit as _diceRollDie).
+ */
+static int _distDie( DiceDist* dist, const DiceOp* op )
+{
+    int sides = op->sides;
+    int lo = op->reroll + 1;
+    double p = 1.0 / (sides - lo + 1);
+    int chain = 1;
+    int m, x;
+
+    if( op->explode )
+    {
+        /* Stop once further explosions are vanishingly unlikely. */
+        double pm = 1.0;
+        while( chain < DICE_EXPLODE_MAX && pm > 1e-16 )
+        {
+            pm *= p;
+            ++chain;
+        }
+    }
+
+    dist->min = lo;
+    dist->max = (chain - 1) * sides + sides;
+    if( dist->max - dist->min + 1 > DIST_LIMIT )
+        return 0;
+    dist->prob = (double*) calloc( dist->max - dist->min + 1,
+                                   sizeof(double) );
+    if( ! dist->prob )
+        return 0;
+
+    {
+    double pm = p;      /* Chance of m explosions then a face. */
+    for( m = 0; m < chain; ++m, pm *= p )
+    {
+        int last = (m == chain - 1) ? sides : sides - 1;
+        for( x = lo; x <= last; ++x )
+            dist->prob[ m * sides + x - lo ] = pm;
+    }
+    }
+    return 1;
+}
+
+
+/*
+ * Set dist to the total of count dice with the given die distribution.
+ * The pool is built by repeated doubling so large pools only need
+ * log2(count) convolutions.
+ */
+static int _distPool( DiceDist* dist, DiceDist* die, int count )
+{
+    DiceDist acc;
+    int ok;
+
+    if( ! _distConst( &acc, 0 ) )
+        return 0;
+
+    for( ok = 1; ok; )
+    {
+        if( count & 1 )
+            ok = _distAdd( &acc, die );
+        count >>= 1;
+        if( ! count )
+            break;
+        if( ok )
+        {
+            DiceDist sq;
+            ok = _distConst( &sq, 0 ) && _distAdd( &sq, die ) &&
+                 _distAdd( &sq, die );
+            diceDistFree( die );
+            *die = sq;
+        }
+    }
+
+    if( ! ok )
+    {
+        diceDistFree( &acc );
+        return 0;
+    }
+    *dist = acc;
+    return 1;
+}
+
+
+/*
+ * Set dist to the total of the highest (keep > 0) or lowest (keep < 0)
+ * dice of a pool.
+ *
+ * Die values are visited from the most to least preferred.  The state is
+ * the number of dice assigned so far and the sum of those kept (the first
+ * keep dice assigned), so each value distributes the remaining dice with
+ * binomial weights.
+ */
+static int _distKeep( DiceDist* dist, const DiceDist* die, int count,
+                      int keep )
+{
+    int values = die->max - die->min + 1;
+    int width, i, j, c, s, k;
+    double *dp, *ndp;
+
+    k = (keep < 0) ? -keep : keep;
+    width = k * die->max + 1;
+    if( (double) (count + 1) * width > DIST_LIMIT ||
+        (double) values * count * count * width > 4e9 )
+        return 0;
+
+    dp  = (double*) calloc( 2 * (count + 1) * width, sizeof(double) );
+    if( ! dp )
+        return 0;
+    ndp = dp + (count + 1) * width;
+    dp[0] = 1.0;
+
+    for( i = 0; i < values; ++i )
+    {
+        int v = (keep > 0) ? die->max - i : die->min + i;
+        double p = die->prob[ v - die->min ];
+        if( p == 0.0 )
+            continue;
+
+        memset( ndp, 0, (count + 1) * width * sizeof(double) );
+        for( j = 0; j <= count; ++j )
+        {
+            double* row = dp + j * width;
+            int kept = (j < k) ? j : k;
+            for( s = 0; s < width; ++s )
+            {
+                double w = row[s];
+                if( w == 0.0 )
+                    continue;
+                /* w * C(count - j, c) * p^c */
+                for( c = 0; c <= count - j; ++c )
+                {
+                    int add = (c < k - kept) ? c : k - kept;
+                    ndp[ (j + c) * width + s + add * v ] += w;
+                    w *= p * (count - j - c) / (c + 1);
+                }
+            }
+        }
+        { double* t = dp; dp = ndp; ndp = t; }
+    }
+
+    dist->min = k * die->min;
+    dist->max = k * die->max;
+    dist->prob = (double*) malloc( (dist->max - dist->min + 1) *
+                                   sizeof(double) );
+    if( dist->prob )
+        memcpy( dist->prob, dp + count * width + dist->min,
+                (dist->max - dist->min + 1) * sizeof(double) );
+    free( (dp < ndp) ? dp : ndp );
+    return dist->prob != NULL;
+}
+
+
+static int _distRoll( DiceDist* dist, const DiceOp* op )
+{
+    DiceDist die;
+    int ok;
+
+    if( ! _distDie( &die, op ) )
+        return 0;
+    if( op->keep )
+        ok = _distKeep( dist, &die, op->count, op->keep );
+    else
+        ok = _distPool( dist, &die, op->count );
+    diceDistFree( &die );
+    return ok;
+}
+
+
+/*
+ * Compute the exact distribution of results for a compiled spec.
+ * Return zero if the number of outcomes is too large.  The caller must
+ * free the result with diceDistFree().
+ */
+static inline int diceDistribution( const DiceOp* it, int len,
+                                    DiceDist* dist )
+{
+    const DiceOp* end = it + len;
+    DiceDist stack[ DICE_STACK ];
+    int sp = 0;
+    int ok = 1;
+
+    for( ; it != end && ok; ++it )
+    {
+        switch( it->op )
+        {
+            case DICE_OP_CONST:
+                ok = _distConst( stack + sp, it->count );
+                if( ok )
+                    ++sp;
+                break;
+            case DICE_OP_ROLL:
+                ok = _distRoll( stack + sp, it );
+                if( ok )
+                    ++sp;
+                break;
+            case DICE_OP_SUB:
+                _distNegate( stack + sp - 1 );
+                /* Fall through... */
+            case DICE_OP_ADD:
+                ok = _distAdd( stack + sp - 2, stack + sp - 1 );
+                diceDistFree( stack + --sp );
+                break;
+            case DICE_OP_MUL:
+                ok = _distMul( stack + sp - 2, stack + sp - 1 );
+                diceDistFree( stack + --sp );
+                break;
+            case DICE_OP_NEG:
+                _distNegate( stack + sp - 1 );
+                break;
+        }
+    }
+
+    if( ! ok || sp != 1 )
+    {
+        while( sp )
+            diceDistFree( stack + --sp );
+        return 0;
+    }
+    *dist = stack[0];
+    return 1;
+}
+
+
+static inline double diceMean( const DiceDist* dist )
+{
+    double sum = 0.0;
+    int v;
+    for( v = dist->min; v <= dist->max; ++v )
+        sum += v * dist->prob[ v - dist->min ];
+    return sum;
+}
+
+
+static inline double diceVariance( const DiceDist* dist )
+{
+    double mean = diceMean( dist );
+    double sum = 0.0;
+    double d;
+    int v;
+    for( v = dist->min; v <= dist->max; ++v )
+    {
+        d = v - mean;
+        sum += d * d * dist->prob[ v - dist->min ];
+    }
+    return sum;
+}
+
+
+/*
+ * Return the smallest total with a cumulative probability of at least p.
+ */
+static inline int dicePercentile( const DiceDist* dist, double p )
+{
+    double cum = 0.0;
+    int v;
+    for( v = dist->min; v < dist->max; ++v )
+    {
+        cum += dist->prob[ v - dist->min ];
+        if( cum >= p - 1e-12 )
+            break;
+    }
+    return v;
+}
+
+
+/*
+ * Return the probability that the total is greater than or equal to target.
+ */
+static inline double diceProbAtLeast( const DiceDist* dist, int target )
+{
+    double sum = 0.0;
+    int v;
+    if( target < dist->min )
+        target = dist->min;
+    for( v = dist->max; v >= target; --v )
+        sum += dist->prob[ v - dist->min ];
+    return (sum > 1.0) ? 1.0 : sum;
+}
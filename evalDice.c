@@ -1,5 +1,5 @@
 /*
-  evalDice.c verion 1.0
+  evalDice.c verion 2.0
   Copyright 2020 Karl Robillard
 
   This program is free software: you can redistribute it and/or modify
@@ -16,72 +16,671 @@
   along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 /*
-  User must define DICE_ROLL and #include this file.
+  User must #include this file.  Dice are rolled with the DiceRng passed to
+  each function unless DICE_ROLL is defined to use another generator.
+  The public functions are static inline so that including programs which
+  do not call all of them compile without unused function warnings.
 
   #define DICE_ROLL(n)    (rand() % n + 1)
   #include "evalDice.c"
 */
 
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
-static int evalDiceToken( int negative, int rollCount, int n )
+
+/*
+ * PCG32 generator (see https://www.pcg-random.org/).  Each thread rolling
+ * dice should have its own DiceRng.
+ *
+ * The draws member counts the values taken since diceSeed() so any point
+ * in the stream can be recreated from (seed, seq, draws) using
+ * diceAdvance().
+ */
+typedef struct
+{
+    uint64_t state;
+    uint64_t inc;
+    uint64_t draws;
+}
+DiceRng;
+
+#define DICE_PCG_MULT   6364136223846793005ULL
+
+
+static uint32_t diceRandom( DiceRng* rng )
+{
+    uint64_t old = rng->state;
+    uint32_t xorshifted, rot;
+
+    rng->state = old * DICE_PCG_MULT + rng->inc;
+    ++rng->draws;
+    xorshifted = (uint32_t) (((old >> 18) ^ old) >> 27);
+    rot = (uint32_t) (old >> 59);
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+
+static inline void diceSeed( DiceRng* rng, uint64_t seed, uint64_t seq )
 {
-    if( rollCount )
+    rng->state = 0;
+    rng->inc = (seq << 1) | 1;
+    diceRandom( rng );
+    rng->state += seed;
+    diceRandom( rng );
+    rng->draws = 0;
+}
+
+
+/*
+ * Skip ahead delta values in O(log delta) time.
+ */
+static inline void diceAdvance( DiceRng* rng, uint64_t delta )
+{
+    uint64_t mult = DICE_PCG_MULT;
+    uint64_t plus = rng->inc;
+    uint64_t accMult = 1;
+    uint64_t accPlus = 0;
+
+    rng->draws += delta;
+    while( delta )
     {
-        int t = 0;
-        while( rollCount-- )
-            t += DICE_ROLL(n);
-        n = t;
+        if( delta & 1 )
+        {
+            accMult *= mult;
+            accPlus = accPlus * mult + plus;
+        }
+        plus = (mult + 1) * plus;
+        mult *= mult;
+        delta >>= 1;
     }
-    return negative ? -n : n;
+    rng->state = accMult * rng->state + accPlus;
 }
 
 
 /*
- * Examples spec strings:
- *    "d20"
- *    "d20+d4-3"
- *    "2+4d6"
+ * Return a uniformly distributed number from 1 to n using Lemire's
+ * multiply & reject method (no modulo bias, rarely divides).
  */
-static int evalDice( const char* spec, void (*emitf)(void*, int), void* user )
+static int diceRange( DiceRng* rng, uint32_t n )
 {
-    int sum = 0;
-    int neg = 0;
-    int roll = 0;
-    int n = 0;
-    int r, ch;
+    uint64_t m = (uint64_t) diceRandom( rng ) * n;
+    uint32_t low = (uint32_t) m;
+    if( low < n )
+    {
+        uint32_t threshold = (0u - n) % n;
+        while( low < threshold )
+        {
+            m = (uint64_t) diceRandom( rng ) * n;
+            low = (uint32_t) m;
+        }
+    }
+    return (int) (m >> 32) + 1;
+}
+
+#ifndef DICE_ROLL
+#define DICE_ROLL(n)    diceRange(rng, n)
+#endif
+
+
+/*
+ * Compiled specs are a postfix program of DiceOp.
+ */
+enum DiceOpcode
+{
+    DICE_OP_CONST,      /* Push count. */
+    DICE_OP_ROLL,       /* Push total of count dice. */
+    DICE_OP_ADD,
+    DICE_OP_SUB,
+    DICE_OP_MUL,
+    DICE_OP_NEG
+};
+
+typedef struct
+{
+    int16_t op;
+    int16_t explode;    /* Roll again & add when a die shows its maximum. */
+    int32_t count;      /* Number of dice or constant value. */
+    int32_t sides;
+    int32_t keep;       /* Keep highest (> 0) or lowest (< 0) dice; 0 = all. */
+    int32_t reroll;     /* Reroll die results less than or equal to this. */
+}
+DiceOp;
+
+#define DICE_OP_MAX         48
+#define DICE_STACK          16
+#define DICE_NUMBER_MAX     1000000
+#define DICE_COUNT_MAX      1000
+#define DICE_KEEP_MAX       100
+#define DICE_EXPLODE_MAX    100
+#define DICE_NEST_MAX       32      /* Limit of unary & parenthesis nesting. */
+
+
+typedef struct
+{
+    const char* it;
+    DiceOp* prog;
+    int len;
+    int depth;          /* Stack slots used by the program. */
+    int nest;           /* Recursion depth of _diceUnary. */
+    int error;
+}
+DiceParser;
+
+
+static void _diceSkipSpace( DiceParser* ps )
+{
+    while( *ps->it == ' ' || *ps->it == '\t' )
+        ++ps->it;
+}
 
-#define EVAL_TOKEN \
-    r = evalDiceToken( neg, roll, n ); \
-    emitf(user, r); \
-    sum += r
 
-    while( (ch = *spec++) )
+static int _diceNumber( DiceParser* ps, int32_t* n )
+{
+    int ch = *ps->it;
+    int32_t v = 0;
+
+    if( ch < '0' || ch > '9' )
+        return 0;
+    do
+    {
+        v = v * 10 + (ch - '0');
+        if( v > DICE_NUMBER_MAX )
+        {
+            ps->error = 1;
+            return 0;
+        }
+        ch = *++ps->it;
+    }
+    while( ch >= '0' && ch <= '9' );
+    *n = v;
+    return 1;
+}
+
+
+static void _diceEmit( DiceParser* ps, int opcode, int32_t count )
+{
+    DiceOp* op;
+
+    if( ps->len == DICE_OP_MAX )
+    {
+        ps->error = 1;
+        return;
+    }
+    op = ps->prog + ps->len++;
+    memset( op, 0, sizeof(DiceOp) );
+    op->op = opcode;
+    op->count = count;
+
+    if( opcode == DICE_OP_CONST || opcode == DICE_OP_ROLL )
+    {
+        if( ++ps->depth > DICE_STACK )
+            ps->error = 1;
+    }
+    else if( opcode != DICE_OP_NEG )
+        --ps->depth;
+}
+
+
+/*
+ * Parse the sides & modifiers of a dice term.  The 'd' has already been
+ * consumed.
+ *   dice := count? 'd' (sides | '%') modifier*
+ *   modifier := '!' | 'r' n | 'k' n | 'kh' n | 'kl' n | 'dh' n | 'dl' n
+ */
+static void _diceRoll( DiceParser* ps, int32_t count )
+{
+    DiceOp* op;
+    int32_t n;
+    int ch;
+
+    if( *ps->it == '%' )
+    {
+        ++ps->it;
+        n = 100;
+    }
+    else if( ! _diceNumber( ps, &n ) || n < 1 )
     {
-        if( ch == 'd' )
+        ps->error = 1;
+        return;
+    }
+    if( count < 1 || count > DICE_COUNT_MAX )
+    {
+        ps->error = 1;
+        return;
+    }
+
+    _diceEmit( ps, DICE_OP_ROLL, count );
+    if( ps->error )
+        return;
+    op = ps->prog + ps->len - 1;
+    op->sides = n;
+
+    for(;;)
+    {
+        ch = *ps->it;
+        if( ch == '!' )
         {
-            roll = n ? n : 1;
-            n = 0;
+            ++ps->it;
+            op->explode = (op->sides > 1);
         }
-        else if( ch == '+' )
+        else if( ch == 'r' )
         {
-            EVAL_TOKEN;
-            n = roll = 0;
-            neg = 0;
+            ++ps->it;
+            if( ! _diceNumber( ps, &n ) || n >= op->sides )
+                goto fail;
+            op->reroll = n;
         }
-        else if( ch == '-' )
+        else if( ch == 'k' || (ch == 'd' &&
+                 (ps->it[1] == 'h' || ps->it[1] == 'l')) )
         {
-            EVAL_TOKEN;
-            n = roll = 0;
-            neg = 1;
+            int drop = (ch == 'd');
+            int high = ! drop;
+
+            ch = *++ps->it;
+            if( ch == 'h' || ch == 'l' )
+            {
+                high = (ch == 'h');
+                ++ps->it;
+            }
+            if( ! _diceNumber( ps, &n ) || n < 1 || n > count )
+                goto fail;
+            if( drop )
+            {
+                n = count - n;      /* Dropping high keeps low & vice versa. */
+                high = ! high;
+                if( n < 1 )
+                    goto fail;
+            }
+            if( n == count )
+                op->keep = 0;
+            else if( count > DICE_KEEP_MAX )
+                goto fail;
+            else
+                op->keep = high ? n : -n;
         }
-        else if( ch >= '0' && ch <= '9' )
+        else
+            break;
+    }
+    return;
+
+fail:
+    ps->error = 1;
+}
+
+
+static void _diceExpr( DiceParser* ps );
+
+/*
+ *  primary := number | dice | '(' expr ')'
+ *  unary   := ('-' | '+')* primary
+ */
+static void _diceUnary( DiceParser* ps )
+{
+    int32_t n;
+
+    if( ++ps->nest > DICE_NEST_MAX )
+    {
+        ps->error = 1;
+        --ps->nest;
+        return;
+    }
+
+    _diceSkipSpace( ps );
+    switch( *ps->it )
+    {
+        case '-':
+            ++ps->it;
+            _diceUnary( ps );
+            _diceEmit( ps, DICE_OP_NEG, 0 );
+            break;
+
+        case '+':
+            ++ps->it;
+            _diceUnary( ps );
+            break;
+
+        case '(':
+            ++ps->it;
+            _diceExpr( ps );
+            _diceSkipSpace( ps );
+            if( *ps->it == ')' )
+                ++ps->it;
+            else
+                ps->error = 1;
+            break;
+
+        case 'd':
+            ++ps->it;
+            _diceRoll( ps, 1 );
+            break;
+
+        default:
+            if( ! _diceNumber( ps, &n ) )
+            {
+                ps->error = 1;
+            }
+            else if( *ps->it == 'd' )
+            {
+                ++ps->it;
+                _diceRoll( ps, n );
+            }
+            else
+                _diceEmit( ps, DICE_OP_CONST, n );
+            break;
+    }
+    --ps->nest;
+}
+
+
+/*
+ *  product := unary ('*' unary)*
+ */
+static void _diceProduct( DiceParser* ps )
+{
+    _diceUnary( ps );
+    while( ! ps->error )
+    {
+        _diceSkipSpace( ps );
+        if( *ps->it != '*' && *ps->it != 'x' )
+            break;
+        ++ps->it;
+        _diceUnary( ps );
+        _diceEmit( ps, DICE_OP_MUL, 0 );
+    }
+}
+
+
+/*
+ *  expr := product (('+' | '-') product)*
+ */
+static void _diceExpr( DiceParser* ps )
+{
+    int ch;
+
+    _diceProduct( ps );
+    while( ! ps->error )
+    {
+        _diceSkipSpace( ps );
+        ch = *ps->it;
+        if( ch != '+' && ch != '-' )
+            break;
+        ++ps->it;
+        _diceProduct( ps );
+        _diceEmit( ps, (ch == '+') ? DICE_OP_ADD : DICE_OP_SUB, 0 );
+    }
+}
+
+
+/*
+ * Return non-zero if every value the program can produce, including the
+ * intermediate results, fits in an int.  The range of each stack slot is
+ * tracked in 64 bits, which cannot overflow as long as each is checked.
+ */
+static int _diceRangeValid( const DiceOp* it, int len )
+{
+    const DiceOp* end = it + len;
+    int64_t lo[ DICE_STACK ];
+    int64_t hi[ DICE_STACK ];
+    int64_t c[4];
+    int64_t t;
+    int sp = 0;
+    int i, k;
+
+    for( ; it != end; ++it )
+    {
+        switch( it->op )
         {
-            n = (n * 10) + (ch - '0');
+            case DICE_OP_CONST:
+                lo[sp] = hi[sp] = it->count;
+                ++sp;
+                break;
+            case DICE_OP_ROLL:
+                k = it->keep ? abs(it->keep) : it->count;
+                lo[sp] = (int64_t) k * (it->reroll + 1);
+                hi[sp] = (int64_t) k * it->sides *
+                         (it->explode ? DICE_EXPLODE_MAX : 1);
+                ++sp;
+                break;
+            case DICE_OP_ADD:
+                --sp;
+                lo[sp-1] += lo[sp];
+                hi[sp-1] += hi[sp];
+                break;
+            case DICE_OP_SUB:
+                --sp;
+                t = lo[sp-1] - hi[sp];
+                hi[sp-1] -= lo[sp];
+                lo[sp-1] = t;
+                break;
+            case DICE_OP_MUL:
+                --sp;
+                c[0] = lo[sp-1] * lo[sp];
+                c[1] = lo[sp-1] * hi[sp];
+                c[2] = hi[sp-1] * lo[sp];
+                c[3] = hi[sp-1] * hi[sp];
+                lo[sp-1] = hi[sp-1] = c[0];
+                for( i = 1; i < 4; ++i )
+                {
+                    if( c[i] < lo[sp-1] ) lo[sp-1] = c[i];
+                    if( c[i] > hi[sp-1] ) hi[sp-1] = c[i];
+                }
+                break;
+            case DICE_OP_NEG:
+                t = -hi[sp-1];
+                hi[sp-1] = -lo[sp-1];
+                lo[sp-1] = t;
+                break;
         }
+        if( lo[sp-1] < INT32_MIN || hi[sp-1] > INT32_MAX )
+            return 0;
+    }
+    return 1;
+}
+
+
+/*
+ * Compile a spec string into a program which can be evaluated repeatedly
+ * with evalDiceProgram().  The prog array must hold DICE_OP_MAX ops.
+ *
+ * Returns the number of ops stored in prog or -1 if the spec is invalid
+ * or its result could overflow an int.
+ */
+static inline int compileDice( const char* spec, DiceOp* prog )
+{
+    DiceParser ps;
+
+    ps.it = spec;
+    ps.prog = prog;
+    ps.len = 0;
+    ps.depth = 0;
+    ps.nest = 0;
+    ps.error = 0;
+
+    _diceExpr( &ps );
+    _diceSkipSpace( &ps );
+    if( ps.error || *ps.it != '\0' || ! _diceRangeValid( prog, ps.len ) )
+        return -1;
+    return ps.len;
+}
+
+
+/*
+ * Return the number of die values passed to emitf for each evaluation of
+ * a program.
+ */
+static inline int diceProgramDice( const DiceOp* it, int len )
+{
+    const DiceOp* end = it + len;
+    int count = 0;
+
+    for( ; it != end; ++it )
+    {
+        if( it->op == DICE_OP_ROLL )
+            count += it->keep ? abs(it->keep) : it->count;
+    }
+    return count;
+}
+
+
+static int _diceRollDie( DiceRng* rng, const DiceOp* op )
+{
+    int total = 0;
+    int explode = 0;
+    int r;
+
+    do
+    {
+        do
+            r = DICE_ROLL(op->sides);
+        while( r <= op->reroll );
+        total += r;
     }
-    EVAL_TOKEN;
+    while( op->explode && r == op->sides && ++explode < DICE_EXPLODE_MAX );
 
-#undef EVAL_TOKEN
+    return total;
+}
+
+
+static int _diceRollOp( DiceRng* rng, const DiceOp* op,
+                        void (*emitf)(void*, int), void* user )
+{
+    int sum = 0;
+    int i, r;
+
+    if( op->keep )
+    {
+        int dice[ DICE_KEEP_MAX ];
+        int keep = op->keep;
+        int j;
 
+        /* Insertion sort so the kept dice are first. */
+        for( i = 0; i < op->count; ++i )
+        {
+            r = _diceRollDie( rng, op );
+            for( j = i; j > 0; --j )
+            {
+                if( (keep > 0) ? (dice[j-1] >= r) : (dice[j-1] <= r) )
+                    break;
+                dice[j] = dice[j-1];
+            }
+            dice[j] = r;
+        }
+
+        if( keep < 0 )
+            keep = -keep;
+        for( i = 0; i < keep; ++i )
+        {
+            sum += dice[i];
+            if( emitf )
+                emitf( user, dice[i] );
+        }
+    }
+    else
+    {
+        for( i = 0; i < op->count; ++i )
+        {
+            r = _diceRollDie( rng, op );
+            sum += r;
+            if( emitf )
+                emitf( user, r );
+        }
+    }
     return sum;
 }
+
+
+/*
+ * Roll a compiled spec.  The value of each kept die is passed to emitf
+ * (if it is not NULL) and the result is returned.
+ */
+static inline int evalDiceProgram( DiceRng* rng, const DiceOp* it, int len,
+                                   void (*emitf)(void*, int), void* user )
+{
+    const DiceOp* end = it + len;
+    int stack[ DICE_STACK ];
+    int sp = 0;
+
+    for( ; it != end; ++it )
+    {
+        switch( it->op )
+        {
+            case DICE_OP_CONST:
+                stack[ sp++ ] = it->count;
+                break;
+            case DICE_OP_ROLL:
+                stack[ sp++ ] = _diceRollOp( rng, it, emitf, user );
+                break;
+            case DICE_OP_ADD:
+                --sp;
+                stack[sp-1] += stack[sp];
+                break;
+            case DICE_OP_SUB:
+                --sp;
+                stack[sp-1] -= stack[sp];
+                break;
+            case DICE_OP_MUL:
+                --sp;
+                stack[sp-1] *= stack[sp];
+                break;
+            case DICE_OP_NEG:
+                stack[sp-1] = -stack[sp-1];
+                break;
+        }
+    }
+    return sp ? stack[0] : 0;
+}
+
+
+static void _diceEmitCursor( void* user, int n )
+{
+    int** cursor = (int**) user;
+    *(*cursor)++ = n;
+}
+
+
+/*
+ * Roll a compiled spec count times.  The totals are stored in sums and, if
+ * dice is not NULL, the kept die values are stored there
+ * (diceProgramDice() values for each roll).  If offsets is not NULL the
+ * rng draws at the start of each roll are stored there.
+ */
+static inline void evalDiceBatch( DiceRng* rng, const DiceOp* prog, int len,
+                                  int count, int* sums, int* dice,
+                                  uint64_t* offsets )
+{
+    int i;
+    for( i = 0; i < count; ++i )
+    {
+        if( offsets )
+            offsets[i] = rng->draws;
+        sums[i] = evalDiceProgram( rng, prog, len,
+                                   dice ? _diceEmitCursor : NULL, &dice );
+    }
+}
+
+
+/*
+ * Examples spec strings:
+ *    "d20"
+ *    "d20+d4-3"
+ *    "2+4d6"
+ *    "4d6kh3"      Keep highest three.
+ *    "2d20kl1"     Keep lowest.
+ *    "4d6dl1"      Drop lowest.
+ *    "3d6!"        Exploding dice.
+ *    "d20r1"       Reroll ones.
+ *    "(d8+2)*2"
+ *
+ * Returns zero if the spec is invalid.
+ */
+static inline int evalDice( DiceRng* rng, const char* spec,
+                            void (*emitf)(void*, int), void* user )
+{
+    DiceOp prog[ DICE_OP_MAX ];
+    int len = compileDice( spec, prog );
+    if( len < 0 )
+        return 0;
+    return evalDiceProgram( rng, prog, len, emitf, user );
+}
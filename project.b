@@ -2,7 +2,39 @@ exe %action-tl [
     qt [widgets]
     sources [
         %Timeline.cpp
+        %TimelineModel.cpp
         %PixmapChooser.cpp
+        %Snapshot.cpp
+        %RollLog.cpp
+        %Session.cpp
+        %ActionList.cpp
+        %Journal.cpp
+        %Trace.cpp
+        %icons.qrc
+    ]
+]
+
+exe %action-sim [
+    sources [
+        %Simulate.cpp
+        %TimelineModel.cpp
+    ]
+]
+
+exe %action-tl-bench [
+    qt [widgets]
+    cflags "-DTIMELINE_NO_MAIN"
+    sources [
+        %Bench.cpp
+        %Timeline.cpp
+        %TimelineModel.cpp
+        %PixmapChooser.cpp
+        %Snapshot.cpp
+        %RollLog.cpp
+        %Session.cpp
+        %ActionList.cpp
+        %Journal.cpp
+        %Trace.cpp
         %icons.qrc
     ]
 ]